@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# Measures the throughput of `cat | tr | wc` through the shell under different pipe settings.
+#
+# Usage: bench/pipe_throughput.sh [path/to/shell] [size in MiB]
+
+set -e
+
+shell=${1:-$(dirname "$0")/../build/shell}
+size_mib=${2:-1024}
+input=$(mktemp)
+trap 'rm -f "$input"' EXIT
+
+head -c "$((size_mib * 1024 * 1024))" /dev/urandom > "$input"
+
+run() {
+    label=$1
+    settings=$2
+    # Warm the page cache so that every run reads the input from memory.
+    cat "$input" > /dev/null
+    start=$(date +%s.%N)
+    printf '%s\ncat %s | tr a-z A-Z | wc -c\n' "$settings" "$input" | "$shell" > /dev/null
+    end=$(date +%s.%N)
+    echo "$label $start $end $size_mib" |
+        awk '{ printf "%-28s %6.2f GB/s\n", $1, $4 * 1048576 / ($3 - $2) / 1e9 }'
+}
+
+run default ':'
+run pipesize=256K 'set -o pipesize=256K'
+run pipesize=1M 'set -o pipesize=1M'
+run pipepin 'set -o pipepin'
+run pipesize=1M,pipepin 'set -o pipesize=1M -o pipepin'
@@ -0,0 +1,697 @@
+#include "arith.h"
+#include "ptr_array.h"
+#include "var.h"
+#include "xmalloc.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Expressions are compiled to code for a stack machine. Jumps implement the operators that do not
+// always evaluate all of their operands: &&, || and ?:.
+typedef enum {
+    OP_PUSH,
+    OP_LOAD,
+    OP_STORE,
+    OP_POP,
+    OP_DUP,
+    OP_NEGATE,
+    OP_NOT,
+    OP_BIT_NOT,
+    OP_BOOL,
+    OP_POW,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_ADD,
+    OP_SUB,
+    OP_SHL,
+    OP_SHR,
+    OP_LESS,
+    OP_LESS_EQUAL,
+    OP_GREATER,
+    OP_GREATER_EQUAL,
+    OP_EQUAL,
+    OP_NOT_EQUAL,
+    OP_BIT_AND,
+    OP_BIT_XOR,
+    OP_BIT_OR,
+    OP_JUMP,
+    OP_JUMP_IF_ZERO,
+    OP_JUMP_IF_NOT_ZERO,
+} OpCode;
+
+// The operand is the value to push, the index of a variable name, or the target of a jump.
+typedef struct {
+    OpCode op;
+    int64_t operand;
+} Instr;
+
+typedef struct {
+    Instr *code;
+    size_t size;
+    size_t capacity;
+    PtrArray *names;
+} Program;
+
+typedef enum {
+    KIND_BINARY,
+    KIND_RIGHT_BINARY,
+    KIND_ASSIGN,
+    KIND_POSTFIX,
+    KIND_AND,
+    KIND_OR,
+    KIND_TERNARY,
+    KIND_COMMA,
+} OperatorKind;
+
+typedef struct {
+    const char *text;
+    int precedence;
+    OperatorKind kind;
+    OpCode op;
+} Operator;
+
+// Infix and postfix operators, longer ones first so that the longest match wins.
+static const Operator operators[] = {
+    {"**=", 2, KIND_ASSIGN, OP_POW},
+    {"<<=", 2, KIND_ASSIGN, OP_SHL},
+    {">>=", 2, KIND_ASSIGN, OP_SHR},
+    {"++", 16, KIND_POSTFIX, OP_ADD},
+    {"--", 16, KIND_POSTFIX, OP_SUB},
+    {"**", 14, KIND_RIGHT_BINARY, OP_POW},
+    {"*=", 2, KIND_ASSIGN, OP_MUL},
+    {"/=", 2, KIND_ASSIGN, OP_DIV},
+    {"%=", 2, KIND_ASSIGN, OP_MOD},
+    {"+=", 2, KIND_ASSIGN, OP_ADD},
+    {"-=", 2, KIND_ASSIGN, OP_SUB},
+    {"&=", 2, KIND_ASSIGN, OP_BIT_AND},
+    {"^=", 2, KIND_ASSIGN, OP_BIT_XOR},
+    {"|=", 2, KIND_ASSIGN, OP_BIT_OR},
+    {"<<", 11, KIND_BINARY, OP_SHL},
+    {">>", 11, KIND_BINARY, OP_SHR},
+    {"<=", 10, KIND_BINARY, OP_LESS_EQUAL},
+    {">=", 10, KIND_BINARY, OP_GREATER_EQUAL},
+    {"==", 9, KIND_BINARY, OP_EQUAL},
+    {"!=", 9, KIND_BINARY, OP_NOT_EQUAL},
+    {"&&", 5, KIND_AND, OP_JUMP_IF_ZERO},
+    {"||", 4, KIND_OR, OP_JUMP_IF_NOT_ZERO},
+    {"*", 13, KIND_BINARY, OP_MUL},
+    {"/", 13, KIND_BINARY, OP_DIV},
+    {"%", 13, KIND_BINARY, OP_MOD},
+    {"+", 12, KIND_BINARY, OP_ADD},
+    {"-", 12, KIND_BINARY, OP_SUB},
+    {"<", 10, KIND_BINARY, OP_LESS},
+    {">", 10, KIND_BINARY, OP_GREATER},
+    {"&", 8, KIND_BINARY, OP_BIT_AND},
+    {"^", 7, KIND_BINARY, OP_BIT_XOR},
+    {"|", 6, KIND_BINARY, OP_BIT_OR},
+    {"=", 2, KIND_ASSIGN, OP_PUSH},
+    {"?", 3, KIND_TERNARY, OP_JUMP_IF_ZERO},
+    {",", 1, KIND_COMMA, OP_POP},
+};
+
+#define PRECEDENCE_UNARY 15
+
+// An operand is assignable if it is a bare variable, whose value was loaded by the instruction at
+// load_index.
+typedef struct {
+    bool is_variable;
+    size_t name_index;
+    size_t load_index;
+} Operand;
+
+static struct {
+    const char *expression;
+    const char *current;
+    Program *program;
+    bool had_error;
+} compiler;
+
+#define CACHE_SIZE 256
+
+// Compiled programs, direct-mapped by the hash of their expression text.
+static struct {
+    char *expression;
+    Program *program;
+} cache[CACHE_SIZE];
+
+// Variables whose values are themselves expressions are evaluated recursively up to this depth.
+#define MAX_DEPTH 64
+
+static int depth = 0;
+
+static Program *program_create(void) {
+    Program *program = xmalloc(sizeof(Program));
+    program->code = NULL;
+    program->size = 0;
+    program->capacity = 0;
+    program->names = ptr_array_create();
+    return program;
+}
+
+static void program_destroy(Program *program) {
+    if (program == NULL) {
+        return;
+    }
+    free(program->code);
+    ptr_array_destroy(program->names, free);
+    free(program);
+}
+
+static size_t emit(OpCode op, int64_t operand) {
+    Program *program = compiler.program;
+    if (program->size == program->capacity) {
+        program->capacity = program->capacity == 0 ? 16 : program->capacity * 2;
+        program->code = xrealloc(program->code, sizeof(Instr) * program->capacity);
+    }
+    program->code[program->size] = (Instr){op, operand};
+    return program->size++;
+}
+
+static void patch_jump(size_t index) {
+    compiler.program->code[index].operand = (int64_t)compiler.program->size;
+}
+
+static void error(const char *message) {
+    if (compiler.had_error) {
+        return;
+    }
+    fprintf(stderr, "%s: %s (error token is \"%s\")\n", compiler.expression, message,
+            compiler.current);
+    compiler.had_error = true;
+}
+
+static void skip_spaces(void) {
+    while (isspace((unsigned char)*compiler.current)) {
+        compiler.current++;
+    }
+}
+
+static bool match(const char *text) {
+    skip_spaces();
+    size_t length = strlen(text);
+    if (strncmp(compiler.current, text, length) != 0) {
+        return false;
+    }
+    compiler.current += length;
+    return true;
+}
+
+static int digit_value(char c) {
+    if (isdigit((unsigned char)c)) {
+        return c - '0';
+    } else if (islower((unsigned char)c)) {
+        return c - 'a' + 10;
+    } else if (isupper((unsigned char)c)) {
+        return c - 'A' + 36;
+    } else if (c == '@') {
+        return 62;
+    } else if (c == '_') {
+        return 63;
+    }
+    return -1;
+}
+
+// Parses an integer constant: decimal, octal with a leading 0, hexadecimal with a leading 0x, or
+// base#digits for bases 2 to 64. Returns a pointer past the constant, or NULL if it is invalid.
+static const char *parse_number(const char *p, int64_t *number) {
+    uint64_t base = 10;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    } else if (p[0] == '0') {
+        base = 8;
+    } else {
+        const char *q = p;
+        uint64_t prefix = 0;
+        while (isdigit((unsigned char)*q)) {
+            prefix = prefix * 10 + (*q++ - '0');
+        }
+        if (*q == '#') {
+            if (prefix < 2 || prefix > 64) {
+                return NULL;
+            }
+            base = prefix;
+            p = q + 1;
+        }
+    }
+
+    uint64_t value = 0;
+    const char *start = p;
+    for (;; p++) {
+        int digit = digit_value(*p);
+        if (digit < 0) {
+            break;
+        }
+        // Below base 37, letters of either case stand for the same digits.
+        if (base <= 36 && digit >= 36) {
+            digit -= 26;
+        }
+        if ((uint64_t)digit >= base) {
+            return NULL;
+        }
+        value = value * base + digit;
+    }
+    if (p == start && base != 8) {
+        return NULL;
+    }
+    *number = (int64_t)value;
+    return p;
+}
+
+static Operand expression(int min_precedence);
+
+static Operand value_operand(void) {
+    return (Operand){.is_variable = false};
+}
+
+static size_t name_index(const char *name, size_t length) {
+    PtrArray *names = compiler.program->names;
+    size_t num_names = ptr_array_get_size(names);
+    for (size_t i = 0; i < num_names; i++) {
+        const char *existing = ptr_array_get_const(names, i);
+        if (strlen(existing) == length && strncmp(existing, name, length) == 0) {
+            return i;
+        }
+    }
+    ptr_array_append(names, xstrndup(name, length));
+    return num_names;
+}
+
+// Compiles the increment or decrement of a variable whose value is on the stack, leaving the new
+// value on the stack.
+static void increment(const Operand *operand, OpCode op) {
+    emit(OP_PUSH, 1);
+    emit(op, 0);
+    emit(OP_STORE, (int64_t)operand->name_index);
+}
+
+static Operand prefix(void) {
+    skip_spaces();
+    const char *p = compiler.current;
+
+    if (match("++") || match("--")) {
+        OpCode op = p[0] == '+' ? OP_ADD : OP_SUB;
+        Operand operand = expression(PRECEDENCE_UNARY);
+        if (!operand.is_variable) {
+            error("assignment requires a variable");
+        }
+        increment(&operand, op);
+        return value_operand();
+    }
+
+    if (*p == '+' || *p == '-' || *p == '!' || *p == '~') {
+        compiler.current++;
+        expression(PRECEDENCE_UNARY);
+        if (*p != '+') {
+            emit(*p == '-' ? OP_NEGATE : *p == '!' ? OP_NOT : OP_BIT_NOT, 0);
+        }
+        return value_operand();
+    }
+
+    if (*p == '(') {
+        compiler.current++;
+        expression(1);
+        if (!match(")")) {
+            error("missing `)'");
+        }
+        return value_operand();
+    }
+
+    if (isdigit((unsigned char)*p)) {
+        int64_t number;
+        const char *end = parse_number(p, &number);
+        if (end == NULL || isalnum((unsigned char)*end) || *end == '_' || *end == '#') {
+            error("invalid number");
+            return value_operand();
+        }
+        compiler.current = end;
+        emit(OP_PUSH, number);
+        return value_operand();
+    }
+
+    if (isalpha((unsigned char)*p) || *p == '_') {
+        const char *end = p;
+        while (isalnum((unsigned char)*end) || *end == '_') {
+            end++;
+        }
+        compiler.current = end;
+        Operand operand = {.is_variable = true, .name_index = name_index(p, end - p)};
+        operand.load_index = emit(OP_LOAD, (int64_t)operand.name_index);
+        return operand;
+    }
+
+    error("operand expected");
+    return value_operand();
+}
+
+static const Operator *find_operator(void) {
+    skip_spaces();
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        size_t length = strlen(operators[i].text);
+        if (strncmp(compiler.current, operators[i].text, length) == 0) {
+            return &operators[i];
+        }
+    }
+    return NULL;
+}
+
+static Operand expression(int min_precedence) {
+    Operand left = prefix();
+
+    while (!compiler.had_error) {
+        const Operator *operator = find_operator();
+        if (operator == NULL || operator->precedence < min_precedence) {
+            break;
+        }
+        compiler.current += strlen(operator->text);
+
+        switch (operator->kind) {
+            case KIND_BINARY:
+                expression(operator->precedence + 1);
+                emit(operator->op, 0);
+                break;
+            case KIND_RIGHT_BINARY:
+                expression(operator->precedence);
+                emit(operator->op, 0);
+                break;
+            case KIND_ASSIGN:
+                if (!left.is_variable) {
+                    error("assignment requires a variable");
+                    break;
+                }
+                if (operator->op == OP_PUSH) {
+                    // A plain assignment does not need the old value.
+                    compiler.program->size = left.load_index;
+                    expression(operator->precedence);
+                } else {
+                    expression(operator->precedence);
+                    emit(operator->op, 0);
+                }
+                emit(OP_STORE, (int64_t)left.name_index);
+                break;
+            case KIND_POSTFIX:
+                if (!left.is_variable) {
+                    error("assignment requires a variable");
+                    break;
+                }
+                emit(OP_DUP, 0);
+                increment(&left, operator->op);
+                emit(OP_POP, 0);
+                break;
+            case KIND_AND:
+            case KIND_OR: {
+                size_t short_circuit = emit(operator->op, 0);
+                expression(operator->precedence + 1);
+                emit(OP_BOOL, 0);
+                size_t end = emit(OP_JUMP, 0);
+                patch_jump(short_circuit);
+                emit(OP_PUSH, operator->kind == KIND_OR);
+                patch_jump(end);
+                break;
+            }
+            case KIND_TERNARY: {
+                size_t to_else = emit(OP_JUMP_IF_ZERO, 0);
+                expression(1);
+                if (!match(":")) {
+                    error("`:' expected for conditional expression");
+                    break;
+                }
+                size_t end = emit(OP_JUMP, 0);
+                patch_jump(to_else);
+                expression(operator->precedence);
+                patch_jump(end);
+                break;
+            }
+            case KIND_COMMA:
+                emit(OP_POP, 0);
+                expression(operator->precedence + 1);
+                break;
+        }
+        left = value_operand();
+    }
+    return left;
+}
+
+static Program *compile(const char *text) {
+    compiler.expression = text;
+    compiler.current = text;
+    compiler.program = program_create();
+    compiler.had_error = false;
+
+    skip_spaces();
+    if (*compiler.current == '\0') {
+        emit(OP_PUSH, 0);
+    } else {
+        expression(1);
+        skip_spaces();
+        if (*compiler.current != '\0') {
+            error("syntax error in expression");
+        }
+    }
+
+    if (compiler.had_error) {
+        program_destroy(compiler.program);
+        return NULL;
+    }
+    return compiler.program;
+}
+
+static size_t hash_text(const char *text) {
+    uint64_t hash = 14695981039346656037u;
+    for (const char *p = text; *p != '\0'; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211u;
+    }
+    return (size_t)hash;
+}
+
+// Finds the compiled program for an expression, compiling it on a miss. Programs are only added to
+// the cache outside of recursive evaluations, so a program never gets evicted while it runs. Sets
+// *cached to tell whether the caller must destroy the program.
+static Program *lookup_or_compile(const char *text, bool *cached) {
+    size_t slot = hash_text(text) & (CACHE_SIZE - 1);
+    *cached = true;
+    if (cache[slot].expression != NULL && strcmp(cache[slot].expression, text) == 0) {
+        return cache[slot].program;
+    }
+
+    Program *program = compile(text);
+    if (program == NULL || depth > 0) {
+        *cached = false;
+        return program;
+    }
+    free(cache[slot].expression);
+    program_destroy(cache[slot].program);
+    cache[slot].expression = xstrdup(text);
+    cache[slot].program = program;
+    return program;
+}
+
+// Returns the value of a variable: 0 if it is unset or empty, and otherwise its value evaluated as
+// an expression.
+static bool load(const char *name, int64_t *value) {
+    const char *text = var_get(name);
+    if (text == NULL || *text == '\0') {
+        *value = 0;
+        return true;
+    }
+
+    const char *p = text;
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+    if (isdigit((unsigned char)*p)) {
+        const char *end = parse_number(p, value);
+        if (end != NULL && *end == '\0') {
+            *value = negative ? (int64_t)(0 - (uint64_t)*value) : *value;
+            return true;
+        }
+    }
+
+    if (depth >= MAX_DEPTH) {
+        fprintf(stderr, "%s: expression recursion level exceeded\n", name);
+        return false;
+    }
+    depth++;
+    bool ok = arith_evaluate(text, value);
+    depth--;
+    return ok;
+}
+
+static bool store(const char *name, int64_t value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%" PRId64, value);
+    return var_set(name, text);
+}
+
+static int64_t power(int64_t base, int64_t exponent) {
+    uint64_t result = 1, factor = (uint64_t)base;
+    while (exponent > 0) {
+        if (exponent & 1) {
+            result *= factor;
+        }
+        factor *= factor;
+        exponent >>= 1;
+    }
+    return (int64_t)result;
+}
+
+// Applies a binary operator. Addition, subtraction and multiplication wrap around like the
+// unsigned arithmetic they are done in, which avoids undefined behavior on overflow.
+static bool apply(OpCode op, int64_t a, int64_t b, int64_t *result, const char *expression) {
+    uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+    switch (op) {
+        case OP_POW:
+            if (b < 0) {
+                fprintf(stderr, "%s: exponent less than 0\n", expression);
+                return false;
+            }
+            *result = power(a, b);
+            break;
+        case OP_MUL:
+            *result = (int64_t)(ua * ub);
+            break;
+        case OP_DIV:
+        case OP_MOD:
+            if (b == 0) {
+                fprintf(stderr, "%s: division by 0\n", expression);
+                return false;
+            }
+            if (b == -1) {
+                *result = op == OP_DIV ? (int64_t)(0 - ua) : 0;
+            } else {
+                *result = op == OP_DIV ? a / b : a % b;
+            }
+            break;
+        case OP_ADD:
+            *result = (int64_t)(ua + ub);
+            break;
+        case OP_SUB:
+            *result = (int64_t)(ua - ub);
+            break;
+        case OP_SHL:
+            *result = (int64_t)(ua << (ub & 63));
+            break;
+        case OP_SHR:
+            *result = a >> (ub & 63);
+            break;
+        case OP_LESS:
+            *result = a < b;
+            break;
+        case OP_LESS_EQUAL:
+            *result = a <= b;
+            break;
+        case OP_GREATER:
+            *result = a > b;
+            break;
+        case OP_GREATER_EQUAL:
+            *result = a >= b;
+            break;
+        case OP_EQUAL:
+            *result = a == b;
+            break;
+        case OP_NOT_EQUAL:
+            *result = a != b;
+            break;
+        case OP_BIT_AND:
+            *result = a & b;
+            break;
+        case OP_BIT_XOR:
+            *result = a ^ b;
+            break;
+        case OP_BIT_OR:
+            *result = a | b;
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+static bool run(const Program *program, const char *expression, int64_t *result) {
+    // Every instruction pushes at most one value, so the stack never outgrows the code.
+    int64_t small_stack[64];
+    int64_t *stack = program->size <= 64 ? small_stack : xmalloc(sizeof(int64_t) * program->size);
+    size_t top = 0;
+    bool ok = true;
+
+    for (size_t pc = 0; ok && pc < program->size; pc++) {
+        const Instr *instr = &program->code[pc];
+        switch (instr->op) {
+            case OP_PUSH:
+                stack[top++] = instr->operand;
+                break;
+            case OP_LOAD:
+                ok = load(ptr_array_get_const(program->names, instr->operand), &stack[top++]);
+                break;
+            case OP_STORE:
+                ok = store(ptr_array_get_const(program->names, instr->operand), stack[top - 1]);
+                break;
+            case OP_POP:
+                top--;
+                break;
+            case OP_DUP:
+                stack[top] = stack[top - 1];
+                top++;
+                break;
+            case OP_NEGATE:
+                stack[top - 1] = (int64_t)(0 - (uint64_t)stack[top - 1]);
+                break;
+            case OP_NOT:
+                stack[top - 1] = !stack[top - 1];
+                break;
+            case OP_BIT_NOT:
+                stack[top - 1] = ~stack[top - 1];
+                break;
+            case OP_BOOL:
+                stack[top - 1] = stack[top - 1] != 0;
+                break;
+            case OP_JUMP:
+                pc = instr->operand - 1;
+                break;
+            case OP_JUMP_IF_ZERO:
+                if (stack[--top] == 0) {
+                    pc = instr->operand - 1;
+                }
+                break;
+            case OP_JUMP_IF_NOT_ZERO:
+                if (stack[--top] != 0) {
+                    pc = instr->operand - 1;
+                }
+                break;
+            default:
+                top--;
+                ok = apply(instr->op, stack[top - 1], stack[top], &stack[top - 1], expression);
+                break;
+        }
+    }
+
+    if (ok) {
+        *result = stack[top - 1];
+    }
+    if (stack != small_stack) {
+        free(stack);
+    }
+    return ok;
+}
+
+bool arith_evaluate(const char *expression, int64_t *result) {
+    bool cached;
+    Program *program = lookup_or_compile(expression, &cached);
+    if (program == NULL) {
+        return false;
+    }
+    bool ok = run(program, expression, result);
+    if (!cached) {
+        program_destroy(program);
+    }
+    return ok;
+}
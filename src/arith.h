@@ -0,0 +1,12 @@
+#ifndef CODECRAFTERS_SHELL_ARITH_H_INCLUDED
+#define CODECRAFTERS_SHELL_ARITH_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Evaluates an arithmetic expression with 64-bit signed integers, the C operators plus **, and
+// assignments to shell variables. Compiled expressions are cached by their text, so evaluating the
+// same expression again does not parse it. Returns false after reporting an error.
+bool arith_evaluate(const char *expression, int64_t *result);
+
+#endif
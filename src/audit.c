@@ -0,0 +1,320 @@
+#include "audit.h"
+#include "var.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Longer records are dropped rather than allowed to overwrite a large part of the log.
+#define MAX_RECORD_SIZE(capacity) ((capacity) / 16)
+
+static struct {
+    AuditHeader *header;
+    char *ring;
+    uint64_t capacity;
+    // The process ID of the caller, which getpid() would cost a system call for on every record.
+    pid_t pid;
+    // The working directory of the shell, or NULL until it is next needed.
+    char *cwd;
+} audit;
+
+// A record being written to the ring.
+typedef struct {
+    AuditRecord *record;
+    uint64_t offset;
+    uint64_t pos;
+} Cursor;
+
+static bool is_valid_header(const AuditHeader *header, off_t file_size) {
+    return memcmp(header->magic, AUDIT_MAGIC, sizeof(AUDIT_MAGIC)) == 0 &&
+           header->version == AUDIT_VERSION && header->header_size == AUDIT_HEADER_SIZE &&
+           header->capacity >= AUDIT_HEADER_SIZE &&
+           (header->capacity & (header->capacity - 1)) == 0 &&
+           (uint64_t)file_size >= AUDIT_HEADER_SIZE + header->capacity;
+}
+
+static void update_pid(void) {
+    audit.pid = getpid();
+}
+
+// Returns the path of the log when the user has not chosen one, creating the directories for it
+// under the state or home directory, or NULL if there is neither.
+static char *get_default_path(void) {
+    const char *state_home = var_get("XDG_STATE_HOME");
+    const char *home = var_get("HOME");
+    const char *root;
+    char *path;
+    int result;
+    if (state_home != NULL && state_home[0] == '/') {
+        root = state_home;
+        result = asprintf(&path, "%s/%s", state_home, AUDIT_DEFAULT_PATH);
+    } else if (home != NULL && home[0] == '/') {
+        root = home;
+        result = asprintf(&path, "%s/.local/state/%s", home, AUDIT_DEFAULT_PATH);
+    } else {
+        return NULL;
+    }
+    if (result < 0) {
+        return NULL;
+    }
+
+    // Each missing directory on the way is created for the user alone.
+    for (char *slash = strchr(path + strlen(root) + 1, '/'); slash != NULL;
+         slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0700);
+        *slash = '/';
+    }
+    return path;
+}
+
+// Lays out a new log in a file that open_log() has just created. Returns the mapping of the file,
+// or MAP_FAILED.
+static void *create_log(int fd, off_t size) {
+    if (ftruncate(fd, size) < 0) {
+        return MAP_FAILED;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED) {
+        AuditHeader *header = map;
+        memcpy(header->magic, AUDIT_MAGIC, sizeof(AUDIT_MAGIC));
+        header->version = AUDIT_VERSION;
+        header->header_size = AUDIT_HEADER_SIZE;
+        header->capacity = AUDIT_DEFAULT_CAPACITY;
+        atomic_store(&header->head, 0);
+    }
+    return map;
+}
+
+// Opens the log at path, reporting errors unless quiet. Only a file that this call creates is laid
+// out as a log; an existing file must already be one, so that a stray AUDITFILE cannot turn an
+// unrelated empty file into a 16 MiB log.
+static void open_log(const char *path, bool quiet) {
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    bool created = fd >= 0;
+    if (!created && errno == EEXIST) {
+        fd = open(path, O_RDWR | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        if (!quiet) {
+            fprintf(stderr, "audit: %s: %s\n", path, strerror(errno));
+        }
+        return;
+    }
+
+    // The creator holds the lock until the header is written, so that a shell starting at the
+    // same time does not find the file still empty.
+    flock(fd, created ? LOCK_EX : LOCK_SH);
+    struct stat st;
+    void *map = MAP_FAILED;
+    bool is_log = true;
+    if (created) {
+        st.st_size = AUDIT_HEADER_SIZE + AUDIT_DEFAULT_CAPACITY;
+        map = create_log(fd, st.st_size);
+        if (map == MAP_FAILED) {
+            int saved_errno = errno;
+            unlink(path);
+            errno = saved_errno;
+        }
+    } else if (fstat(fd, &st) == 0) {
+        // A file too short for the header, such as an empty one, is not a log either.
+        is_log = st.st_size >= AUDIT_HEADER_SIZE;
+        if (is_log) {
+            map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            is_log = map == MAP_FAILED || is_valid_header(map, st.st_size);
+        }
+    }
+    int saved_errno = errno;
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    if (!is_log) {
+        if (!quiet) {
+            fprintf(stderr, "audit: %s: not an audit log\n", path);
+        }
+        if (map != MAP_FAILED) {
+            munmap(map, st.st_size);
+        }
+        return;
+    } else if (map == MAP_FAILED) {
+        if (!quiet) {
+            fprintf(stderr, "audit: %s: %s\n", path, strerror(saved_errno));
+        }
+        return;
+    }
+    audit.header = map;
+    audit.ring = (char *)map + AUDIT_HEADER_SIZE;
+    audit.capacity = audit.header->capacity;
+    update_pid();
+    pthread_atfork(NULL, NULL, update_pid);
+}
+
+void audit_init(void) {
+    const char *path = var_get("AUDITFILE");
+    if (path != NULL) {
+        if (path[0] != '\0') {
+            open_log(path, false);
+        }
+        return;
+    }
+    // A log the user did not ask for should not get in the way, such as with a read-only home.
+    char *default_path = get_default_path();
+    if (default_path != NULL) {
+        open_log(default_path, true);
+        free(default_path);
+    }
+}
+
+uint64_t audit_now(void) {
+    if (audit.header == NULL) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void audit_chdir(void) {
+    free(audit.cwd);
+    audit.cwd = NULL;
+}
+
+// Reserves space in the ring for a record with a payload of the given size. Returns false if the
+// log is off or the record is too large.
+static bool reserve(Cursor *cursor, AuditType type, size_t payload_size) {
+    if (audit.header == NULL) {
+        return false;
+    }
+    uint64_t size = sizeof(AuditRecord) + payload_size;
+    size = (size + sizeof(AuditRecord) - 1) & ~(uint64_t)(sizeof(AuditRecord) - 1);
+    if (size > MAX_RECORD_SIZE(audit.capacity)) {
+        return false;
+    }
+
+    cursor->offset = atomic_fetch_add_explicit(&audit.header->head, size, memory_order_relaxed);
+    uint64_t pos = cursor->offset & (audit.capacity - 1);
+    cursor->record = (AuditRecord *)(audit.ring + pos);
+    cursor->record->size = size;
+    cursor->record->type = type;
+    cursor->pos = pos + sizeof(AuditRecord);
+    return true;
+}
+
+static void put(Cursor *cursor, const void *data, size_t length) {
+    uint64_t pos = cursor->pos & (audit.capacity - 1);
+    size_t first = length < audit.capacity - pos ? length : audit.capacity - pos;
+    memcpy(audit.ring + pos, data, first);
+    memcpy(audit.ring, (const char *)data + first, length - first);
+    cursor->pos = pos + length;
+}
+
+static void put_string(Cursor *cursor, const char *s) {
+    put(cursor, s, strlen(s) + 1);
+}
+
+// Marks a record complete, after everything else in it is visible.
+static void commit(Cursor *cursor) {
+    atomic_store_explicit(&cursor->record->offset, cursor->offset, memory_order_release);
+}
+
+void audit_start(AuditStart *start) {
+    if (audit.header == NULL) {
+        *start = (AuditStart){0, NULL};
+        return;
+    }
+    if (audit.cwd == NULL) {
+        audit.cwd = getcwd(NULL, 0);
+    }
+    start->start_ns = audit_now();
+    start->cwd = strdup(audit.cwd != NULL ? audit.cwd : "");
+}
+
+void audit_pipeline(AuditStart *start, const char *text, const int *statuses, size_t num_stages,
+                    bool background) {
+    if (audit.header == NULL) {
+        return;
+    }
+    const char *cwd = start->cwd != NULL ? start->cwd : "";
+
+    AuditPipeline pipeline = {
+        .start_ns = start->start_ns,
+        .end_ns = audit_now(),
+        .pid = audit.pid,
+        .status = num_stages > 0 ? statuses[num_stages - 1] : 0,
+        .num_stages = num_stages,
+        .background = background,
+    };
+    size_t size = sizeof(pipeline) + sizeof(int32_t) * num_stages + strlen(cwd) + strlen(text) + 2;
+    Cursor cursor;
+    if (!reserve(&cursor, AUDIT_PIPELINE, size)) {
+        free(start->cwd);
+        return;
+    }
+    put(&cursor, &pipeline, sizeof(pipeline));
+    for (size_t i = 0; i < num_stages; i++) {
+        int32_t status = statuses[i];
+        put(&cursor, &status, sizeof(status));
+    }
+    put_string(&cursor, cwd);
+    put_string(&cursor, text);
+    commit(&cursor);
+    free(start->cwd);
+}
+
+void audit_exec(const PtrArray *arguments) {
+    if (audit.header == NULL) {
+        return;
+    }
+    size_t argc = ptr_array_get_size(arguments);
+    AuditExec exec = {.time_ns = audit_now(), .pid = audit.pid, .argc = argc};
+    size_t size = sizeof(exec);
+    for (size_t i = 0; i < argc; i++) {
+        size += strlen(ptr_array_get_const(arguments, i)) + 1;
+    }
+    Cursor cursor;
+    if (!reserve(&cursor, AUDIT_EXEC, size)) {
+        return;
+    }
+    put(&cursor, &exec, sizeof(exec));
+    for (size_t i = 0; i < argc; i++) {
+        put_string(&cursor, ptr_array_get_const(arguments, i));
+    }
+    commit(&cursor);
+}
+
+static int64_t to_us(const struct timeval *tv) {
+    return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+void audit_process(pid_t pid, uint64_t start_ns, int wait_status, const struct rusage *usage) {
+    Cursor cursor;
+    if (!reserve(&cursor, AUDIT_PROCESS, sizeof(AuditProcess))) {
+        return;
+    }
+    AuditProcess process = {
+        .start_ns = start_ns,
+        .end_ns = audit_now(),
+        .pid = pid,
+        .wait_status = wait_status,
+        .utime_us = to_us(&usage->ru_utime),
+        .stime_us = to_us(&usage->ru_stime),
+        .maxrss_kb = usage->ru_maxrss,
+        .minflt = usage->ru_minflt,
+        .majflt = usage->ru_majflt,
+        .inblock = usage->ru_inblock,
+        .oublock = usage->ru_oublock,
+        .nvcsw = usage->ru_nvcsw,
+        .nivcsw = usage->ru_nivcsw,
+    };
+    put(&cursor, &process, sizeof(process));
+    commit(&cursor);
+}
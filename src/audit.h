@@ -0,0 +1,119 @@
+#ifndef CODECRAFTERS_SHELL_AUDIT_H_INCLUDED
+#define CODECRAFTERS_SHELL_AUDIT_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "ptr_array.h"
+
+// The audit log is a file holding an AuditHeader followed by a ring of records. Writers reserve
+// space by advancing the head atomically, so the shell and its children append to the same
+// mapping without locks, and the oldest records are overwritten once the ring is full. A record
+// starts with an AuditRecord whose offset is stored last, so a record is complete once its offset
+// matches the position it was written at. All fields are in native byte order.
+
+#define AUDIT_MAGIC "SHAUDIT"
+#define AUDIT_VERSION 1
+#define AUDIT_HEADER_SIZE 4096
+
+// The size of the ring in a new log. An existing log keeps its own.
+#define AUDIT_DEFAULT_CAPACITY (16u * 1024 * 1024)
+
+// Where the log is without AUDITFILE, under $XDG_STATE_HOME or else ~/.local/state.
+#define AUDIT_DEFAULT_PATH "shell/audit.ring"
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    // The size of the ring, a power of two.
+    uint64_t capacity;
+    // The number of bytes ever reserved. A record at offset o is at o % capacity in the ring.
+    _Atomic uint64_t head;
+} AuditHeader;
+
+typedef enum {
+    // A pipeline that the shell ran, written when it finishes or, in the background, starts.
+    AUDIT_PIPELINE = 1,
+    // The arguments of a command, written by the process that runs it.
+    AUDIT_EXEC,
+    // A child process that the shell reaped.
+    AUDIT_PROCESS,
+} AuditType;
+
+// Records are aligned to their header size, so that a header never wraps around the end of the
+// ring. The size includes the header and padding.
+typedef struct {
+    uint32_t size;
+    uint32_t type;
+    _Atomic uint64_t offset;
+} AuditRecord;
+
+// Followed by num_stages int32_t exit statuses, then the working directory and the command text as
+// NUL-terminated strings.
+typedef struct {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int32_t pid;
+    int32_t status;
+    uint32_t num_stages;
+    uint32_t background;
+} AuditPipeline;
+
+// Followed by argc NUL-terminated strings.
+typedef struct {
+    uint64_t time_ns;
+    int32_t pid;
+    uint32_t argc;
+} AuditExec;
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int32_t pid;
+    // As returned by wait4().
+    int32_t wait_status;
+    int64_t utime_us;
+    int64_t stime_us;
+    int64_t maxrss_kb;
+    int64_t minflt;
+    int64_t majflt;
+    int64_t inblock;
+    int64_t oublock;
+    int64_t nvcsw;
+    int64_t nivcsw;
+} AuditProcess;
+
+// Opens the audit log, creating it if needed. The AUDITFILE variable names the log, and an empty
+// one turns logging off. Without the variable, the log is at AUDIT_DEFAULT_PATH, and logging is
+// quietly off if that cannot be opened.
+void audit_init(void);
+
+// Returns the current time for the timestamps of records, or 0 if the log is off.
+uint64_t audit_now(void);
+
+// Notes that the working directory of the shell changed.
+void audit_chdir(void);
+
+// What is recorded about a pipeline as it starts, as running it can change the working directory.
+typedef struct {
+    uint64_t start_ns;
+    char *cwd;
+} AuditStart;
+
+// Notes the start of a pipeline. Every start must be passed to audit_pipeline().
+void audit_start(AuditStart *start);
+
+// Records a pipeline, and deallocates memory for its start.
+void audit_pipeline(AuditStart *start, const char *text, const int *statuses, size_t num_stages,
+                    bool background);
+
+// Records the arguments of a command about to run in the calling process.
+void audit_exec(const PtrArray *arguments);
+
+// Records a child process that the shell reaped.
+void audit_process(pid_t pid, uint64_t start_ns, int wait_status, const struct rusage *usage);
+
+#endif
@@ -2,12 +2,14 @@
 #include "misc.h"
 #include "ptr_array.h"
 #include "trie.h"
+#include "var.h"
 #include "xmalloc.h"
 
 #include <readline/readline.h>
 #include <stdlib.h>
 
 static Trie *trie = NULL;
+static unsigned long path_generation;
 
 static void add_names(const PtrArray *names) {
     size_t num_names = ptr_array_get_size(names);
@@ -18,13 +20,17 @@ static void add_names(const PtrArray *names) {
 }
 
 static void init_trie(void) {
+    if (trie != NULL) {
+        trie_destroy(trie);
+    }
     trie = trie_create();
+    path_generation = var_get_path_generation();
     add_names(get_all_builtin_names());
     add_names(get_all_executable_names());
 }
 
 static char *shell_completion_generator(const char *text, int state) {
-    if (trie == NULL) {
+    if (trie == NULL || path_generation != var_get_path_generation()) {
         init_trie();
     }
 
@@ -48,3 +54,12 @@ char **shell_completion(const char *text, int start, int end) {
     rl_attempted_completion_over = 1;
     return rl_completion_matches(text, shell_completion_generator);
 }
+
+void autocmp_get_trie_size(size_t *num_nodes, size_t *num_bytes) {
+    if (trie == NULL) {
+        *num_nodes = 0;
+        *num_bytes = 0;
+        return;
+    }
+    trie_get_size(trie, num_nodes, num_bytes);
+}
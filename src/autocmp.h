@@ -1,6 +1,11 @@
 #ifndef CODECRAFTERS_SHELL_CMP_H_INCLUDED
 #define CODECRAFTERS_SHELL_CMP_H_INCLUDED
 
+#include <stddef.h>
+
 char **shell_completion(const char *text, int start, int end);
 
+// Gets the size of the completion trie, which is 0 until the first completion builds it.
+void autocmp_get_trie_size(size_t *num_nodes, size_t *num_bytes);
+
 #endif
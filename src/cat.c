@@ -0,0 +1,215 @@
+#include "cat.h"
+#include "xmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The most that one system call moves. Splicing more than a pipe holds only returns early.
+#define CHUNK_SIZE (1024 * 1024)
+
+#define BUFFER_SIZE (128 * 1024)
+
+bool cat_is_native(const PtrArray *arguments, bool in_child) {
+    size_t num_args = ptr_array_get_size(arguments);
+    bool options_done = false;
+    size_t num_files = 0;
+    for (size_t i = 1; i < num_args; i++) {
+        const char *arg = ptr_array_get_const(arguments, i);
+        if (!options_done && strcmp(arg, "--") == 0) {
+            options_done = true;
+            continue;
+        } else if (!options_done && strcmp(arg, "-u") == 0) {
+            continue;
+        } else if (!options_done && arg[0] == '-' && arg[1] != '\0') {
+            return false;
+        }
+
+        struct stat st;
+        bool regular = strcmp(arg, "-") != 0 && (stat(arg, &st) < 0 || S_ISREG(st.st_mode));
+        if (!in_child && !regular) {
+            return false;
+        }
+        num_files++;
+    }
+    // Without files, cat copies its standard input.
+    return in_child || num_files > 0;
+}
+
+// The ways of moving data between file descriptors without copying it through user space, tried in
+// order. Each fails with EINVAL or similar for file types that it does not support.
+typedef enum {
+    COPY_FILE_RANGE,
+    SPLICE,
+    SENDFILE,
+    READ_WRITE,
+} Method;
+
+static Method choose_method(const struct stat *in, const struct stat *out, bool append) {
+    if (S_ISREG(in->st_mode) && S_ISREG(out->st_mode) && !append) {
+        return COPY_FILE_RANGE;
+    } else if (S_ISFIFO(in->st_mode) || S_ISFIFO(out->st_mode)) {
+        return SPLICE;
+    } else if (S_ISREG(in->st_mode) || S_ISBLK(in->st_mode)) {
+        return SENDFILE;
+    }
+    return READ_WRITE;
+}
+
+static bool write_all(int fd, const char *buf, size_t length) {
+    while (length > 0) {
+        ssize_t num_written = write(fd, buf, length);
+        if (num_written < 0 && errno == EINTR) {
+            continue;
+        } else if (num_written < 0) {
+            return false;
+        }
+        buf += num_written;
+        length -= num_written;
+    }
+    return true;
+}
+
+// Copies a file descriptor to standard output through a buffer. Returns false with errno set on an
+// error, and sets *write_failed if it was writing that failed.
+static bool copy_through_buffer(int fd, int out, bool *write_failed) {
+    static char *buf = NULL;
+    if (buf == NULL) {
+        buf = xmalloc(BUFFER_SIZE);
+    }
+    for (;;) {
+        ssize_t num_read = read(fd, buf, BUFFER_SIZE);
+        if (num_read < 0 && errno == EINTR) {
+            continue;
+        } else if (num_read <= 0) {
+            return num_read == 0;
+        }
+        if (!write_all(out, buf, num_read)) {
+            *write_failed = true;
+            return false;
+        }
+    }
+}
+
+// Copies a file descriptor to another, starting with the fastest method that their types allow and
+// falling back to the next one when the kernel rejects it. Data already moved stays moved, since
+// all methods advance the file offsets.
+static bool copy_fd(int fd, int out, bool *write_failed) {
+    struct stat in_st, out_st;
+    if (fstat(fd, &in_st) < 0 || fstat(out, &out_st) < 0) {
+        return false;
+    }
+    bool append = (fcntl(out, F_GETFL) & O_APPEND) != 0;
+
+    for (Method method = choose_method(&in_st, &out_st, append); method != READ_WRITE; method++) {
+        if (method == SPLICE && !S_ISFIFO(in_st.st_mode) && !S_ISFIFO(out_st.st_mode)) {
+            continue;
+        }
+        ssize_t num_moved;
+        do {
+            switch (method) {
+                case COPY_FILE_RANGE:
+                    num_moved = copy_file_range(fd, NULL, out, NULL, CHUNK_SIZE, 0);
+                    break;
+                case SPLICE:
+                    num_moved = splice(fd, NULL, out, NULL, CHUNK_SIZE, SPLICE_F_MOVE);
+                    break;
+                default:
+                    num_moved = sendfile(out, fd, NULL, CHUNK_SIZE);
+                    break;
+            }
+        } while (num_moved > 0 || (num_moved < 0 && errno == EINTR));
+
+        if (num_moved == 0) {
+            return true;
+        } else if (errno != EINVAL && errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP &&
+                   errno != EBADF) {
+            // The error may be on either side; EPIPE and ENOSPC are the usual ones on output.
+            *write_failed = errno == EPIPE || errno == ENOSPC || errno == EDQUOT;
+            return false;
+        }
+    }
+    return copy_through_buffer(fd, out, write_failed);
+}
+
+// Copies a file descriptor to the stdout stream, which is a stream in memory while a command
+// substitution is captured.
+static bool copy_to_stream(int fd) {
+    char buf[BUFSIZ];
+    for (;;) {
+        ssize_t num_read = read(fd, buf, sizeof(buf));
+        if (num_read < 0 && errno == EINTR) {
+            continue;
+        } else if (num_read <= 0) {
+            return num_read == 0;
+        }
+        fwrite(buf, 1, num_read, stdout);
+    }
+}
+
+// Copies one file to standard output. Returns 0 on success, 1 after reporting an error, or -1 after
+// reporting an error writing the output, which ends the command.
+static int cat_file(const char *name, int out) {
+    bool is_stdin = strcmp(name, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    struct stat in_st, out_st;
+    bool write_failed = false;
+    int status = 0;
+    if (fstat(fd, &in_st) == 0 && S_ISDIR(in_st.st_mode)) {
+        fprintf(stderr, "cat: %s: %s\n", name, strerror(EISDIR));
+        status = 1;
+    } else if (out >= 0 && S_ISREG(in_st.st_mode) && fstat(out, &out_st) == 0 &&
+               in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino &&
+               in_st.st_size > 0) {
+        // Appending a file to itself would never end.
+        fprintf(stderr, "cat: %s: input file is output file\n", name);
+        status = 1;
+    } else if (!(out < 0 ? copy_to_stream(fd) : copy_fd(fd, out, &write_failed))) {
+        fprintf(stderr, "cat: %s: %s\n", write_failed ? "write error" : name, strerror(errno));
+        status = write_failed ? -1 : 1;
+    }
+
+    if (!is_stdin) {
+        close(fd);
+    }
+    return status;
+}
+
+int cmd_cat(const PtrArray *arguments) {
+    // Output that builtins have buffered in the stdout stream comes first.
+    fflush(stdout);
+    int out = fileno(stdout);
+
+    size_t num_args = ptr_array_get_size(arguments);
+    bool options_done = false;
+    size_t num_files = 0;
+    int status = 0;
+    for (size_t i = 1; i < num_args; i++) {
+        const char *name = ptr_array_get_const(arguments, i);
+        if (!options_done && strcmp(name, "--") == 0) {
+            options_done = true;
+        } else if (options_done || strcmp(name, "-u") != 0) {
+            num_files++;
+            int file_status = cat_file(name, out);
+            if (file_status < 0) {
+                return 1;
+            }
+            status |= file_status;
+        }
+    }
+    // Without files, cat copies its standard input.
+    if (num_files == 0) {
+        status = cat_file("-", out) != 0;
+    }
+    return status;
+}
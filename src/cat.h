@@ -0,0 +1,16 @@
+#ifndef CODECRAFTERS_SHELL_CAT_H_INCLUDED
+#define CODECRAFTERS_SHELL_CAT_H_INCLUDED
+
+#include <stdbool.h>
+
+#include "ptr_array.h"
+
+// Checks whether the cat builtin handles a command line. Options other than -u are left to the
+// external cat, and so is input that may never end when cat would run in the shell process itself,
+// which ignores interrupts.
+bool cat_is_native(const PtrArray *arguments, bool in_child);
+
+// Concatenates files to standard output (the cat builtin).
+int cmd_cat(const PtrArray *arguments);
+
+#endif
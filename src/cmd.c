@@ -1,27 +1,52 @@
 #include "cmd.h"
+#include "arith.h"
+#include "audit.h"
+#include "cat.h"
+#include "expand.h"
+#include "jobs.h"
 #include "misc.h"
+#include "options.h"
+#include "parallel.h"
+#include "printf.h"
 #include "ptr_array.h"
+#include "read.h"
 #include "redir.h"
+#include "serial.h"
+#include "source.h"
+#include "stats.h"
+#include "str_buf.h"
+#include "subst.h"
+#include "test.h"
+#include "var.h"
 #include "xmalloc.h"
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <readline/history.h>
 #include <readline/readline.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
-static void cmd_cd(const PtrArray *arguments) {
+static int cmd_cd(const PtrArray *arguments) {
     const char *dir = ptr_array_get_const(arguments, 1);
     if (chdir(dir) < 0) {
         fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+        return 1;
     }
+    audit_chdir();
+    return 0;
 }
 
-static void cmd_echo(const PtrArray *arguments) {
+static int cmd_colon(const PtrArray *arguments) {
+    return 0;
+}
+
+static int cmd_echo(const PtrArray *arguments) {
     size_t num_args = ptr_array_get_size(arguments);
     for (size_t i = 1; i < num_args; i++) {
         if (i > 1) {
@@ -30,14 +55,24 @@ static void cmd_echo(const PtrArray *arguments) {
         printf("%s", (const char *)ptr_array_get_const(arguments, i));
     }
     printf("\n");
+    return 0;
 }
 
+static int last_status = 0;
+
 static void cmd_exit(const PtrArray *arguments) {
-    int status = atoi((const char *)ptr_array_get_const(arguments, 1));
+    int status = last_status;
+    if (ptr_array_get_size(arguments) > 1) {
+        status = atoi((const char *)ptr_array_get_const(arguments, 1));
+    }
     exit(status);
 }
 
-static void cmd_history(const PtrArray *arguments) {
+static int cmd_false(const PtrArray *arguments) {
+    return 1;
+}
+
+static int cmd_history(const PtrArray *arguments) {
     static int last_append_n = 0;
     int n = history_length + 1 - history_base;
 
@@ -53,7 +88,7 @@ static void cmd_history(const PtrArray *arguments) {
             append_history(n - last_append_n, histfile);
             last_append_n = n;
         }
-        return;
+        return 0;
     }
 
     if (ptr_array_get_size(arguments) > 1) {
@@ -64,15 +99,22 @@ static void cmd_history(const PtrArray *arguments) {
         HIST_ENTRY *entry = history_get(i);
         printf("%5d  %s\n", i, entry->line);
     }
+    return 0;
 }
 
-static void cmd_pwd(const PtrArray *arguments) {
+static int cmd_pwd(const PtrArray *arguments) {
     char *cwd = getcwd(NULL, 0);
     printf("%s\n", cwd);
     free(cwd);
+    return 0;
+}
+
+static int cmd_true(const PtrArray *arguments) {
+    return 0;
 }
 
-static void cmd_type(const PtrArray *arguments) {
+static int cmd_type(const PtrArray *arguments) {
+    int status = 0;
     size_t num_args = ptr_array_get_size(arguments);
     for (size_t i = 1; i < num_args; i++) {
         const char *name = ptr_array_get_const(arguments, i);
@@ -90,70 +132,386 @@ static void cmd_type(const PtrArray *arguments) {
         }
 
         printf("%s: not found\n", name);
+        status = 1;
     }
+    return status;
 }
 
-static void execute_builtin(const PtrArray *arguments) {
+static int execute_builtin(const PtrArray *arguments) {
     const char *cmd_name = ptr_array_get_const(arguments, 0);
-    if (strcmp(cmd_name, "cd") == 0) {
-        cmd_cd(arguments);
+    if (strcmp(cmd_name, ".") == 0 || strcmp(cmd_name, "source") == 0) {
+        return cmd_source(arguments);
+    } else if (strcmp(cmd_name, ":") == 0) {
+        return cmd_colon(arguments);
+    } else if (strcmp(cmd_name, "[") == 0 || strcmp(cmd_name, "test") == 0) {
+        return cmd_test(arguments);
+    } else if (strcmp(cmd_name, "bg") == 0) {
+        return cmd_bg(arguments);
+    } else if (strcmp(cmd_name, "cat") == 0) {
+        return cmd_cat(arguments);
+    } else if (strcmp(cmd_name, "cd") == 0) {
+        return cmd_cd(arguments);
     } else if (strcmp(cmd_name, "echo") == 0) {
-        cmd_echo(arguments);
+        return cmd_echo(arguments);
     } else if (strcmp(cmd_name, "exit") == 0) {
         cmd_exit(arguments);
+    } else if (strcmp(cmd_name, "export") == 0) {
+        return cmd_export(arguments);
+    } else if (strcmp(cmd_name, "false") == 0) {
+        return cmd_false(arguments);
+    } else if (strcmp(cmd_name, "fg") == 0) {
+        return cmd_fg(arguments);
     } else if (strcmp(cmd_name, "history") == 0) {
-        cmd_history(arguments);
+        return cmd_history(arguments);
+    } else if (strcmp(cmd_name, "jobs") == 0) {
+        return cmd_jobs(arguments);
+    } else if (strcmp(cmd_name, "local") == 0) {
+        return cmd_local(arguments);
+    } else if (strcmp(cmd_name, "mapfile") == 0 || strcmp(cmd_name, "readarray") == 0) {
+        return cmd_mapfile(arguments);
+    } else if (strcmp(cmd_name, "parallel") == 0) {
+        return cmd_parallel(arguments);
+    } else if (strcmp(cmd_name, "printf") == 0) {
+        return cmd_printf(arguments);
     } else if (strcmp(cmd_name, "pwd") == 0) {
-        cmd_pwd(arguments);
+        return cmd_pwd(arguments);
+    } else if (strcmp(cmd_name, "read") == 0) {
+        return cmd_read(arguments);
+    } else if (strcmp(cmd_name, "readonly") == 0) {
+        return cmd_readonly(arguments);
+    } else if (strcmp(cmd_name, "set") == 0) {
+        return cmd_set(arguments);
+    } else if (strcmp(cmd_name, "shellstat") == 0) {
+        return cmd_shellstat(arguments);
+    } else if (strcmp(cmd_name, "true") == 0) {
+        return cmd_true(arguments);
     } else if (strcmp(cmd_name, "type") == 0) {
-        cmd_type(arguments);
+        return cmd_type(arguments);
+    } else if (strcmp(cmd_name, "unset") == 0) {
+        return cmd_unset(arguments);
+    } else if (strcmp(cmd_name, "wait") == 0) {
+        return cmd_wait(arguments);
+    }
+    return 0;
+}
+
+// Adds the bytes that strings take in execve() to *size. Returns false if one is longer than the
+// kernel takes.
+static bool add_exec_size(const PtrArray *strings, size_t max_string, size_t *size) {
+    size_t num_strings = ptr_array_get_size(strings);
+    for (size_t i = 0; i < num_strings; i++) {
+        size_t length = strlen(ptr_array_get_const(strings, i)) + 1;
+        if (length > max_string) {
+            return false;
+        }
+        *size += length + sizeof(char *);
+    }
+    return true;
+}
+
+// Checks whether execve() can take the arguments along with the environment, which the
+// assignments before the command add to, as the kernel limits their size to ARG_MAX in total and
+// each string to 32 pages. An assignment is counted as a new variable even if it replaces one, so
+// the check errs on the side of refusing. Prints an error if they do not fit.
+static bool check_arg_max(const PtrArray *arguments, const PtrArray *assignments) {
+    long arg_max = sysconf(_SC_ARG_MAX);
+    size_t max_string = 32 * (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = var_get_envp_size();
+    bool fits = add_exec_size(arguments, max_string, &size) &&
+                add_exec_size(assignments, max_string, &size);
+    if (!fits || (arg_max > 0 && size > (size_t)arg_max)) {
+        fprintf(stderr, "%s: argument list too long\n",
+                (const char *)ptr_array_get_const(arguments, 0));
+        return false;
     }
+    return true;
 }
 
 __attribute__((noreturn))
 static void execute_external(const char *path, PtrArray *arguments) {
+    audit_exec(arguments);
+    stats_add(STAT_EXECS, 1);
     ptr_array_append(arguments, NULL);
-    execvp(path, (char **)ptr_array_get_c_array(arguments));
-    err(EXIT_FAILURE, "execvp");
+    execve(path, (char **)ptr_array_get_c_array(arguments), var_get_envp());
+    err(EXIT_FAILURE, "execve");
 }
 
 struct Cmd {
-    PtrArray *arguments;
+    char *arith;
+    PtrArray *assignments;
+    PtrArray *words;
     PtrArray *redirs;
 };
 
-static void execute(Cmd *cmd, bool fork_on_external) {
+struct Pipeline {
+    PtrArray *cmds;
+    char *text;
+    PipelineCondition condition;
+    bool background;
+};
+
+static int *pipestatus = NULL;
+static size_t pipestatus_size = 0;
+
+// The exit status of the last command substitution while expanding the current command, or -1.
+static int substitution_status = -1;
+
+static void set_pipestatus(const int *statuses, size_t size) {
+    pipestatus = xrealloc(pipestatus, sizeof(int) * size);
+    memcpy(pipestatus, statuses, sizeof(int) * size);
+    pipestatus_size = size;
+    last_status = statuses[size - 1];
+}
+
+void set_last_status(int status) {
+    set_pipestatus(&status, 1);
+}
+
+void set_substitution_status(int status) {
+    substitution_status = status;
+    set_pipestatus(&status, 1);
+}
+
+// Expands the values of the variable assignments of a command into NAME=value strings. Returns
+// NULL if an expansion failed.
+static PtrArray *expand_assignments(const Cmd *cmd) {
+    PtrArray *assignments = ptr_array_create();
+    size_t num_assignments = ptr_array_get_size(cmd->assignments);
+    for (size_t i = 0; i < num_assignments; i++) {
+        const char *word = ptr_array_get_const(cmd->assignments, i);
+        const char *equals = strchr(word, '=');
+        char *value = expand_word(equals + 1);
+        if (value == NULL) {
+            ptr_array_destroy(assignments, free);
+            return NULL;
+        }
+        size_t name_length = equals - word + 1;
+        char *assignment = xmalloc(name_length + strlen(value) + 1);
+        memcpy(assignment, word, name_length);
+        strcpy(assignment + name_length, value);
+        free(value);
+        ptr_array_append(assignments, assignment);
+    }
+    return assignments;
+}
+
+// Assigns NAME=value strings to variables, exporting them if requested. If saved is not NULL, the
+// previous values are appended to it so that they can be restored. Returns false if a variable is
+// readonly.
+static bool assign(const PtrArray *assignments, PtrArray *saved, bool export) {
+    size_t num_assignments = ptr_array_get_size(assignments);
+    for (size_t i = 0; i < num_assignments; i++) {
+        const char *assignment = ptr_array_get_const(assignments, i);
+        if (saved != NULL) {
+            char *name = xstrndup(assignment, strchr(assignment, '=') - assignment);
+            const char *old_value = var_get(name);
+            ptr_array_append(saved, old_value != NULL ? xstrdup(old_value) : NULL);
+            free(name);
+        }
+        if (!var_assign(assignment, export)) {
+            if (saved != NULL) {
+                free(ptr_array_pop(saved));
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+// Restores the variables saved by assign(), in reverse order in case a name was assigned twice.
+static void restore(const PtrArray *assignments, PtrArray *saved) {
+    for (size_t i = ptr_array_get_size(saved); i-- > 0;) {
+        const char *assignment = ptr_array_get_const(assignments, i);
+        char *name = xstrndup(assignment, strchr(assignment, '=') - assignment);
+        const char *old_value = ptr_array_get_const(saved, i);
+        if (old_value != NULL) {
+            var_set(name, old_value);
+        } else {
+            var_unset(name);
+        }
+        free(name);
+    }
+}
+
+static void undo_redirs(Cmd *cmd, size_t num_redirs) {
+    for (size_t i = 0; i < num_redirs; i++) {
+        redir_undo((Redir *)ptr_array_get(cmd->redirs, num_redirs - 1 - i));
+    }
+}
+
+// Does the redirections of a command in order. If one fails, the ones already done are undone.
+// Returns false if a redirection failed.
+static bool do_redirs(Cmd *cmd, bool restorable) {
     size_t num_redirs = ptr_array_get_size(cmd->redirs);
     for (size_t i = 0; i < num_redirs; i++) {
-        redir_do((Redir *)ptr_array_get(cmd->redirs, i));
+        if (!redir_do((Redir *)ptr_array_get(cmd->redirs, i), restorable)) {
+            if (restorable) {
+                undo_redirs(cmd, i);
+            }
+            return false;
+        }
     }
+    return true;
+}
+
+static int execute_arith(Cmd *cmd, bool restorable) {
+    if (!do_redirs(cmd, restorable)) {
+        return 1;
+    }
+    char *expression = expand_word(cmd->arith);
+    int64_t result;
+    int status = expression != NULL && arith_evaluate(expression, &result) && result != 0 ? 0 : 1;
+    free(expression);
+    if (restorable) {
+        undo_redirs(cmd, ptr_array_get_size(cmd->redirs));
+    }
+    return status;
+}
+
+// Checks whether a command runs as a builtin. The cat builtin leaves some command lines to the
+// external cat.
+static bool runs_as_builtin(const PtrArray *arguments, bool in_child) {
+    const char *name = ptr_array_get_const(arguments, 0);
+    return is_builtin(name) && (strcmp(name, "cat") != 0 || cat_is_native(arguments, in_child));
+}
+
+// Executes a command. Builtins run in the current process; external commands replace it when it is
+// already a child of the shell, and run as a foreground job otherwise.
+static int execute_simple(Cmd *cmd, bool in_child, const char *text) {
+    substitution_status = -1;
+    PtrArray *arguments = expand_words(cmd->words);
+    PtrArray *assignments = arguments != NULL ? expand_assignments(cmd) : NULL;
+    if (assignments == NULL) {
+        // A failed expansion, such as ${name?}, has reported an error and skips the command.
+        if (arguments != NULL) {
+            ptr_array_destroy(arguments, free);
+        }
+        return 1;
+    }
+    int status = 0;
+
+    // A child of the shell exits after running the command, so it has nothing to restore.
+    bool restorable = !in_child;
+    size_t num_redirs = ptr_array_get_size(cmd->redirs);
 
-    const char *cmd_name = ptr_array_get(cmd->arguments, 0);
-    if (is_builtin(cmd_name)) {
-        execute_builtin(cmd->arguments);
+    if (ptr_array_is_empty(arguments)) {
+        // Without a command, the assignments affect the shell itself, and the exit status is that
+        // of the last command substitution.
+        if (!do_redirs(cmd, restorable)) {
+            status = 1;
+        } else {
+            if (!assign(assignments, NULL, false)) {
+                status = 1;
+            } else {
+                status = substitution_status >= 0 ? substitution_status : 0;
+            }
+            if (restorable) {
+                undo_redirs(cmd, num_redirs);
+            }
+        }
+    } else if (runs_as_builtin(arguments, in_child)) {
+        if (!do_redirs(cmd, restorable)) {
+            status = 1;
+        } else {
+            PtrArray *saved = ptr_array_create();
+            if (!assign(assignments, saved, false)) {
+                status = 1;
+            } else {
+                audit_exec(arguments);
+                status = execute_builtin(arguments);
+                fflush(stdout);
+            }
+            restore(assignments, saved);
+            ptr_array_destroy(saved, free);
+            if (restorable) {
+                undo_redirs(cmd, num_redirs);
+            }
+        }
     } else {
-        char *path = find_executable(cmd_name);
+        const char *cmd_name = ptr_array_get_const(arguments, 0);
+        char *path = strchr(cmd_name, '/') != NULL ? xstrdup(cmd_name) : find_executable(cmd_name);
         if (path == NULL) {
             fprintf(stderr, "%s: command not found\n", cmd_name);
-            return;
-        }
-
-        if (!fork_on_external || fork() == 0) {
-            execute_external(path, cmd->arguments);
+            status = 127;
+        } else if (!check_arg_max(arguments, assignments)) {
+            // Failing here spares forking a child only for execve() to fail in it.
+            status = 126;
+        } else if (in_child) {
+            if (!do_redirs(cmd, false)) {
+                exit(EXIT_FAILURE);
+            }
+            if (!assign(assignments, NULL, true)) {
+                exit(EXIT_FAILURE);
+            }
+            execute_external(path, arguments);
+        } else {
+            Job *job = job_create(text, false);
+            if (job_fork(job) == 0) {
+                if (!do_redirs(cmd, false)) {
+                    exit(EXIT_FAILURE);
+                }
+                if (!assign(assignments, NULL, true)) {
+                    exit(EXIT_FAILURE);
+                }
+                execute_external(path, arguments);
+            }
+            job_wait(job, &status);
         }
-        wait(NULL);
         free(path);
     }
 
-    for (size_t i = 0; i < num_redirs; i++) {
-        redir_undo((Redir *)ptr_array_get(cmd->redirs, num_redirs - 1 - i));
+    ptr_array_destroy(assignments, free);
+    ptr_array_destroy(arguments, free);
+    return status;
+}
+
+// Executes a command, then finishes the process substitutions in its words and redirections.
+static int execute(Cmd *cmd, bool in_child, const char *text) {
+    size_t first_substitution = get_num_process_substitutions();
+    int status = cmd->arith != NULL ? execute_arith(cmd, !in_child)
+                                    : execute_simple(cmd, in_child, text);
+    finish_process_substitutions(first_substitution);
+    return status;
+}
+
+int execute_cmd_in_child(Cmd *cmd) {
+    return execute(cmd, true, NULL);
+}
+
+// Checks whether a word has the form NAME=value with an unquoted name.
+static bool is_assignment(const char *word) {
+    const char *equals = strchr(word, '=');
+    if (equals == NULL) {
+        return false;
     }
+    char *name = xstrndup(word, equals - word);
+    bool valid = is_valid_name(name);
+    free(name);
+    return valid;
 }
 
-Cmd *cmd_create(PtrArray *arguments, PtrArray *redirs) {
+Cmd *cmd_create(PtrArray *words, PtrArray *redirs) {
     Cmd *cmd = xmalloc(sizeof(Cmd));
-    cmd->arguments = arguments;
+    cmd->arith = NULL;
+    cmd->assignments = ptr_array_create();
+    cmd->words = ptr_array_create();
     cmd->redirs = redirs;
+
+    // Assignments are only recognized before the command name.
+    size_t num_words = ptr_array_get_size(words);
+    bool in_prefix = true;
+    for (size_t i = 0; i < num_words; i++) {
+        char *word = ptr_array_get(words, i);
+        in_prefix = in_prefix && is_assignment(word);
+        ptr_array_append(in_prefix ? cmd->assignments : cmd->words, word);
+    }
+    ptr_array_destroy(words, NULL);
+    return cmd;
+}
+
+Cmd *cmd_create_arith(char *expression, PtrArray *redirs) {
+    Cmd *cmd = cmd_create(ptr_array_create(), redirs);
+    cmd->arith = expression;
     return cmd;
 }
 
@@ -162,39 +520,264 @@ void cmd_destroy(void *ptr) {
         return;
     }
     Cmd *cmd = ptr;
-    ptr_array_destroy(cmd->arguments, free);
+    free(cmd->arith);
+    ptr_array_destroy(cmd->assignments, free);
+    ptr_array_destroy(cmd->words, free);
     ptr_array_destroy(cmd->redirs, redir_destroy);
     free(cmd);
 }
 
-void execute_cmds(PtrArray *cmds) {
-    size_t num_cmds = ptr_array_get_size(cmds);
-    if (num_cmds == 0) {
+Pipeline *pipeline_create(PtrArray *cmds, char *text, PipelineCondition condition,
+                          bool background) {
+    Pipeline *pipeline = xmalloc(sizeof(Pipeline));
+    pipeline->cmds = cmds;
+    pipeline->text = text;
+    pipeline->condition = condition;
+    pipeline->background = background;
+    return pipeline;
+}
+
+void pipeline_set_background(Pipeline *pipeline) {
+    pipeline->background = true;
+}
+
+bool pipeline_is_capturable(const Pipeline *pipeline) {
+    // Builtins that write to the stdout stream and leave the state of the shell alone.
+    static const char *const capturable[] = {":", "[", "echo", "false", "printf", "pwd", "test",
+                                             "true", "type"};
+
+    if (pipeline->background || ptr_array_get_size(pipeline->cmds) != 1) {
+        return false;
+    }
+    const Cmd *cmd = ptr_array_get_const(pipeline->cmds, 0);
+    if (ptr_array_is_empty(cmd->words) || !ptr_array_is_empty(cmd->assignments) ||
+        !ptr_array_is_empty(cmd->redirs)) {
+        return false;
+    }
+
+    // The name must be a literal, since expanding it here could have side effects.
+    const char *name = ptr_array_get_const(cmd->words, 0);
+    if (strpbrk(name, "\\\'\"$`*?~") != NULL) {
+        return false;
+    }
+    if (strcmp(name, "cat") == 0) {
+        // Whether cat runs as a builtin depends on its arguments, which must be literals too.
+        size_t num_words = ptr_array_get_size(cmd->words);
+        for (size_t i = 1; i < num_words; i++) {
+            if (strpbrk(ptr_array_get_const(cmd->words, i), "\\\'\"$`*?~[<>") != NULL) {
+                return false;
+            }
+        }
+        return cat_is_native(cmd->words, false);
+    }
+    for (size_t i = 0; i < sizeof(capturable) / sizeof(capturable[0]); i++) {
+        if (strcmp(name, capturable[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void write_strings(const PtrArray *strings, FILE *stream) {
+    size_t num_strings = ptr_array_get_size(strings);
+    for (size_t i = 0; i < num_strings; i++) {
+        serial_write_string(stream, ptr_array_get_const(strings, i));
+    }
+}
+
+// A command is written as its expression, if it is arithmetic, then its assignments and words,
+// which cmd_create() tells apart again, and its redirections.
+static void write_cmd(const Cmd *cmd, FILE *stream) {
+    serial_write_u64(stream, cmd->arith != NULL);
+    if (cmd->arith != NULL) {
+        serial_write_string(stream, cmd->arith);
+    }
+    serial_write_u64(stream, ptr_array_get_size(cmd->assignments) + ptr_array_get_size(cmd->words));
+    write_strings(cmd->assignments, stream);
+    write_strings(cmd->words, stream);
+    size_t num_redirs = ptr_array_get_size(cmd->redirs);
+    serial_write_u64(stream, num_redirs);
+    for (size_t i = 0; i < num_redirs; i++) {
+        redir_write(ptr_array_get_const(cmd->redirs, i), stream);
+    }
+}
+
+static Cmd *read_cmd(FILE *stream) {
+    uint64_t is_arith, num_words, num_redirs;
+    char *arith = NULL;
+    if (!serial_read_u64(stream, &is_arith) ||
+        (is_arith && (arith = serial_read_string(stream)) == NULL) ||
+        !serial_read_u64(stream, &num_words)) {
+        return NULL;
+    }
+
+    PtrArray *words = ptr_array_create();
+    PtrArray *redirs = ptr_array_create();
+    bool ok = true;
+    for (uint64_t i = 0; ok && i < num_words; i++) {
+        char *word = serial_read_string(stream);
+        ok = word != NULL;
+        if (ok) {
+            ptr_array_append(words, word);
+        }
+    }
+    ok = ok && serial_read_u64(stream, &num_redirs);
+    for (uint64_t i = 0; ok && i < num_redirs; i++) {
+        Redir *redir = redir_read(stream);
+        ok = redir != NULL;
+        if (ok) {
+            ptr_array_append(redirs, redir);
+        }
+    }
+    if (!ok) {
+        free(arith);
+        ptr_array_destroy(words, free);
+        ptr_array_destroy(redirs, redir_destroy);
+        return NULL;
+    }
+
+    Cmd *cmd = cmd_create(words, redirs);
+    cmd->arith = arith;
+    return cmd;
+}
+
+void pipeline_write(const Pipeline *pipeline, FILE *stream) {
+    serial_write_string(stream, pipeline->text);
+    serial_write_u64(stream, pipeline->condition);
+    serial_write_u64(stream, pipeline->background);
+    size_t num_cmds = ptr_array_get_size(pipeline->cmds);
+    serial_write_u64(stream, num_cmds);
+    for (size_t i = 0; i < num_cmds; i++) {
+        write_cmd(ptr_array_get_const(pipeline->cmds, i), stream);
+    }
+}
+
+Pipeline *pipeline_read(FILE *stream) {
+    char *text = serial_read_string(stream);
+    uint64_t condition, background, num_cmds;
+    if (text == NULL || !serial_read_u64(stream, &condition) ||
+        condition > PIPELINE_IF_FAILURE || !serial_read_u64(stream, &background) ||
+        !serial_read_u64(stream, &num_cmds) || num_cmds == 0) {
+        free(text);
+        return NULL;
+    }
+
+    PtrArray *cmds = ptr_array_create();
+    for (uint64_t i = 0; i < num_cmds; i++) {
+        Cmd *cmd = read_cmd(stream);
+        if (cmd == NULL) {
+            free(text);
+            ptr_array_destroy(cmds, cmd_destroy);
+            return NULL;
+        }
+        ptr_array_append(cmds, cmd);
+    }
+    return pipeline_create(cmds, text, condition, background != 0);
+}
+
+void pipeline_destroy(void *ptr) {
+    if (ptr == NULL) {
         return;
-    } else if (num_cmds == 1) {
-        execute((Cmd *)ptr_array_get(cmds, 0), true);
+    }
+    Pipeline *pipeline = ptr;
+    ptr_array_destroy(pipeline->cmds, cmd_destroy);
+    free(pipeline->text);
+    free(pipeline);
+}
+
+// Pins the calling process to the n-th CPU that the shell may run on, wrapping around, so that
+// consecutive pipeline stages run on neighbouring cores and hand data over through warm caches.
+static void pin_to_cpu(size_t n) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 || CPU_COUNT(&allowed) == 0) {
         return;
     }
 
+    size_t target = n % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && target-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+            return;
+        }
+    }
+}
+
+// Sets the capacity of a pipe, reporting only the first failure, as the kernel can refuse larger
+// pipes once a user's pipes take too much memory in total.
+static void set_pipe_size(int fd, size_t size) {
+    static bool reported = false;
+    if (fcntl(fd, F_SETPIPE_SZ, (int)size) < 0 && !reported) {
+        fprintf(stderr, "pipesize: %s; using the default capacity\n", strerror(errno));
+        reported = true;
+    }
+}
+
+// Stops a pipeline that could not be set up completely: the stages already started are terminated
+// and reaped. read_fd is the read end of the last pipe, which no stage has taken yet, or -1.
+static void abort_pipeline(Job *job, int read_fd, size_t num_cmds) {
+    if (read_fd >= 0) {
+        close(read_fd);
+    }
+    job_kill(job, SIGTERM);
+    int *statuses = xmalloc(sizeof(int) * num_cmds);
+    job_wait(job, statuses);
+    free(statuses);
+}
+
+static void execute_cmds(Pipeline *pipeline) {
+    PtrArray *cmds = pipeline->cmds;
+    size_t num_cmds = ptr_array_get_size(cmds);
+    AuditStart start;
+    audit_start(&start);
+    if (num_cmds == 1 && !pipeline->background) {
+        int status = execute((Cmd *)ptr_array_get(cmds, 0), false, pipeline->text);
+        set_pipestatus(&status, 1);
+        audit_pipeline(&start, pipeline->text, &status, 1, false);
+        return;
+    }
+
+    Job *job = job_create(pipeline->text, pipeline->background);
     int fds[2], prev_rfd;
+    size_t pipe_size = options_get_pipe_size();
+    bool pin_stages = options_get_pin_stages() && num_cmds > 1;
+
+    // Successive pipelines start on different CPUs so that they do not all crowd the first ones.
+    static size_t first_cpu = 0;
+    first_cpu += num_cmds;
 
     for (size_t i = 0; i < num_cmds; i++) {
         if (i < num_cmds - 1) {
-            pipe(fds);
+            if (pipe(fds) < 0) {
+                perror("pipe");
+                abort_pipeline(job, i > 0 ? prev_rfd : -1, num_cmds);
+                int status = 1;
+                set_pipestatus(&status, 1);
+                audit_pipeline(&start, pipeline->text, &status, 1, false);
+                return;
+            }
+            if (pipe_size > 0) {
+                set_pipe_size(fds[1], pipe_size);
+            }
         }
 
-        if (fork() == 0) {
+        if (job_fork(job) == 0) {
+            if (pin_stages) {
+                pin_to_cpu(first_cpu + i);
+            }
             if (i > 0) {
                 dup2(prev_rfd, STDIN_FILENO);
                 close(prev_rfd);
             }
             if (i < num_cmds - 1) {
+                close(fds[0]);
                 dup2(fds[1], STDOUT_FILENO);
                 close(fds[1]);
             }
 
-            execute((Cmd *)ptr_array_get(cmds, i), false);
-            exit(EXIT_SUCCESS);
+            exit(execute((Cmd *)ptr_array_get(cmds, i), true, pipeline->text));
         }
 
         if (i > 0) {
@@ -207,7 +790,121 @@ void execute_cmds(PtrArray *cmds) {
         prev_rfd = fds[0];
     }
 
-    for (size_t i = 0; i < num_cmds; i++) {
-        wait(NULL);
+    if (pipeline->background) {
+        job_background(job);
+        int status = 0;
+        set_pipestatus(&status, 1);
+        audit_pipeline(&start, pipeline->text, NULL, 0, true);
+        return;
+    }
+
+    int *statuses = xmalloc(sizeof(int) * num_cmds);
+    job_wait(job, statuses);
+    set_pipestatus(statuses, num_cmds);
+    audit_pipeline(&start, pipeline->text, statuses, num_cmds, false);
+    free(statuses);
+}
+
+// Checks whether a pipeline runs after the ones before it in its list. A skipped pipeline leaves
+// the exit status alone, so that the list ends with the status of the last one that ran.
+static bool should_run(const Pipeline *pipeline) {
+    switch (pipeline->condition) {
+        case PIPELINE_IF_SUCCESS:
+            return last_status == 0;
+        case PIPELINE_IF_FAILURE:
+            return last_status != 0;
+        default:
+            return true;
     }
 }
+
+// Runs the pipelines in [start, end), a background list joined by && or ||, as one job in a child
+// that decides which of them run.
+static void execute_background_list(PtrArray *pipelines, size_t start, size_t end) {
+    StrBuf *text = str_buf_create();
+    for (size_t i = start; i < end; i++) {
+        const Pipeline *pipeline = ptr_array_get_const(pipelines, i);
+        if (i > start) {
+            str_buf_append(text, pipeline->condition == PIPELINE_IF_SUCCESS ? " && " : " || ");
+        }
+        str_buf_append(text, pipeline->text);
+    }
+    Job *job = job_create(str_buf_get(text), true);
+    str_buf_destroy(text);
+
+    if (job_fork(job) == 0) {
+        PtrArray *list = ptr_array_create();
+        for (size_t i = start; i < end; i++) {
+            Pipeline *pipeline = ptr_array_get(pipelines, i);
+            pipeline->background = false;
+            ptr_array_append(list, pipeline);
+        }
+        execute_pipelines_in_child(list);
+    }
+    job_background(job);
+    int status = 0;
+    set_pipestatus(&status, 1);
+}
+
+// Returns the end of the list of pipelines joined by && or || that starts at the given one.
+static size_t get_list_end(const PtrArray *pipelines, size_t start) {
+    size_t num_pipelines = ptr_array_get_size(pipelines);
+    size_t end = start + 1;
+    while (end < num_pipelines) {
+        const Pipeline *pipeline = ptr_array_get_const(pipelines, end);
+        if (pipeline->condition == PIPELINE_ALWAYS) {
+            break;
+        }
+        end++;
+    }
+    return end;
+}
+
+static void execute_range(PtrArray *pipelines, size_t start, size_t end) {
+    for (size_t i = start; i < end;) {
+        Pipeline *pipeline = ptr_array_get(pipelines, i);
+        size_t list_end = get_list_end(pipelines, i);
+        if (pipeline->background && list_end - i > 1) {
+            execute_background_list(pipelines, i, list_end);
+            i = list_end;
+            continue;
+        }
+        if (should_run(pipeline)) {
+            execute_cmds(pipeline);
+        }
+        i++;
+    }
+}
+
+void execute_pipelines(PtrArray *pipelines) {
+    execute_range(pipelines, 0, ptr_array_get_size(pipelines));
+}
+
+void execute_pipelines_in_child(PtrArray *pipelines) {
+    size_t num_pipelines = ptr_array_get_size(pipelines);
+    if (num_pipelines == 0) {
+        exit(last_status);
+    }
+
+    // The last command can replace the child instead of being forked again. A foreground pipeline
+    // is never part of a background list, so it can be run on its own.
+    Pipeline *last = ptr_array_get(pipelines, num_pipelines - 1);
+    if (last->background || ptr_array_get_size(last->cmds) != 1) {
+        execute_pipelines(pipelines);
+        exit(last_status);
+    }
+    execute_range(pipelines, 0, num_pipelines - 1);
+    if (!should_run(last)) {
+        exit(last_status);
+    }
+    exit(execute((Cmd *)ptr_array_get(last->cmds, 0), true, last->text));
+}
+
+int get_last_status(void) {
+    return last_status;
+}
+
+const int *get_pipestatus(size_t *size) {
+    *size = pipestatus_size;
+    return pipestatus;
+}
@@ -1,18 +1,79 @@
 #ifndef CODECRAFTERS_SHELL_CMD_H_INCLUDED
 #define CODECRAFTERS_SHELL_CMD_H_INCLUDED
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
 #include "ptr_array.h"
 
 typedef struct Cmd Cmd;
 
-// Allocates memory for a command.
-Cmd *cmd_create(PtrArray *arguments, PtrArray *redirs);
+typedef struct Pipeline Pipeline;
+
+// Whether a pipeline runs depends on how it is joined to the one before it: after ;, & or a newline
+// it always does, after && only if that one succeeded, and after || only if it failed.
+typedef enum {
+    PIPELINE_ALWAYS,
+    PIPELINE_IF_SUCCESS,
+    PIPELINE_IF_FAILURE,
+} PipelineCondition;
+
+// Allocates memory for a command. Leading words of the form NAME=value are variable assignments,
+// and the remaining words are expanded into arguments when the command is executed.
+Cmd *cmd_create(PtrArray *words, PtrArray *redirs);
+
+// Allocates memory for an arithmetic command, ((expression)), which takes ownership of the
+// expression. Its exit status is 0 if the expression evaluates to nonzero and 1 otherwise.
+Cmd *cmd_create_arith(char *expression, PtrArray *redirs);
 
 // Deallocates memory for a command.
 void cmd_destroy(void *cmd);
 
-// Executes one or more commands. In the case of multiple commands, a pipeline is created to
-// transmit input/output between them.
-void execute_cmds(PtrArray *cmds);
+// Executes a command in a child of the shell. An external command replaces the child; a builtin
+// returns its exit status.
+int execute_cmd_in_child(Cmd *cmd);
+
+// Allocates memory for a pipeline of one or more commands. The text describes the pipeline when it
+// is listed as a job. A background pipeline that is joined to others by && or || runs along with
+// them as one job, so all pipelines of such a list are marked as background.
+Pipeline *pipeline_create(PtrArray *cmds, char *text, PipelineCondition condition,
+                          bool background);
+
+// Marks a pipeline to run in the background, as the parser learns only at the end of a list.
+void pipeline_set_background(Pipeline *pipeline);
+
+// Checks whether a pipeline is a single builtin that only writes to the stdout stream and does not
+// change the state of the shell, so that its output can be captured without forking.
+bool pipeline_is_capturable(const Pipeline *pipeline);
+
+// Writes a pipeline to a stream in a form that pipeline_read() reads back.
+void pipeline_write(const Pipeline *pipeline, FILE *stream);
+
+// Reads a pipeline written by pipeline_write(). Returns NULL if the data is truncated or malformed.
+Pipeline *pipeline_read(FILE *stream);
+
+// Deallocates memory for a pipeline.
+void pipeline_destroy(void *pipeline);
+
+// Executes pipelines in order, skipping those whose condition does not hold. Foreground pipelines
+// are waited for before the next one starts.
+void execute_pipelines(PtrArray *pipelines);
+
+// Executes pipelines in a child of the shell, which the last command replaces when possible, and
+// exits with the last exit status.
+__attribute__((noreturn)) void execute_pipelines_in_child(PtrArray *pipelines);
+
+// Sets the last exit status, as for a line that failed before any command ran.
+void set_last_status(int status);
+
+// Records the exit status of a command substitution as the last exit status.
+void set_substitution_status(int status);
+
+// Returns the exit status of the most recent foreground pipeline.
+int get_last_status(void);
+
+// Returns the exit statuses of the commands in the most recent foreground pipeline.
+const int *get_pipestatus(size_t *size);
 
 #endif
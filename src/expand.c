@@ -0,0 +1,953 @@
+#include "expand.h"
+#include "arith.h"
+#include "cmd.h"
+#include "jobs.h"
+#include "misc.h"
+#include "pattern.h"
+#include "ptr_array.h"
+#include "str_buf.h"
+#include "subst.h"
+#include "var.h"
+#include "xmalloc.h"
+
+#include <ctype.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    DELIM_NONE,
+    DELIM_SPACE,
+    DELIM_OTHER,
+} Delimiter;
+
+typedef struct {
+    PtrArray *fields;
+    StrBuf *text;
+    StrBuf *pattern;
+    bool split;
+    bool has_field;
+    bool has_glob;
+    bool failed;
+    // Set while expanding the word of an unquoted ${name-word}, whose literal characters are split.
+    bool split_literals;
+    Delimiter last_delimiter;
+    char *ifs;
+} Expander;
+
+static void init(Expander *ex, bool split) {
+    ex->fields = ptr_array_create();
+    ex->text = str_buf_create();
+    ex->pattern = str_buf_create();
+    ex->split = split;
+    ex->has_field = false;
+    ex->has_glob = false;
+    ex->failed = false;
+    ex->split_literals = false;
+    ex->last_delimiter = DELIM_NONE;
+    // A command substitution may assign IFS while the expansion is in progress.
+    const char *ifs = var_get("IFS");
+    ex->ifs = xstrdup(ifs != NULL ? ifs : " \t\n");
+}
+
+static void finish(Expander *ex) {
+    free(ex->ifs);
+    str_buf_destroy(ex->text);
+    str_buf_destroy(ex->pattern);
+}
+
+// Adds a character to the current field. The pattern used for pathname expansion escapes quoted
+// characters so that only unquoted ones act as wildcards.
+static void add_char(Expander *ex, char c, bool quoted) {
+    str_buf_append_char(ex->text, c);
+    if (quoted && strchr("*?[]\\", c) != NULL) {
+        str_buf_append_char(ex->pattern, '\\');
+    } else if (!quoted && strchr("*?[", c) != NULL) {
+        ex->has_glob = true;
+    }
+    str_buf_append_char(ex->pattern, c);
+    ex->has_field = true;
+    ex->last_delimiter = DELIM_NONE;
+}
+
+static void end_field(Expander *ex) {
+    if (!ex->has_field) {
+        return;
+    }
+
+    glob_t matches;
+    if (ex->has_glob && glob(str_buf_get(ex->pattern), 0, NULL, &matches) == 0) {
+        for (size_t i = 0; i < matches.gl_pathc; i++) {
+            ptr_array_append(ex->fields, xstrdup(matches.gl_pathv[i]));
+        }
+        globfree(&matches);
+    } else {
+        ptr_array_append(ex->fields, xstrdup(str_buf_get(ex->text)));
+    }
+
+    str_buf_clear(ex->text);
+    str_buf_clear(ex->pattern);
+    ex->has_field = false;
+    ex->has_glob = false;
+}
+
+// Adds the result of an expansion to the current field. Unquoted results are split into fields at
+// IFS characters: runs of IFS whitespace separate fields, and every other IFS character delimits
+// exactly one field.
+static void add_expansion(Expander *ex, const char *value, bool quoted) {
+    if (quoted || !ex->split) {
+        for (const char *p = value; *p != '\0'; p++) {
+            add_char(ex, *p, quoted);
+        }
+        return;
+    }
+
+    for (const char *p = value; *p != '\0'; p++) {
+        if (strchr(ex->ifs, *p) == NULL) {
+            add_char(ex, *p, false);
+        } else if (*p == ' ' || *p == '\t' || *p == '\n') {
+            end_field(ex);
+            if (ex->last_delimiter == DELIM_NONE) {
+                ex->last_delimiter = DELIM_SPACE;
+            }
+        } else {
+            if (ex->last_delimiter != DELIM_SPACE) {
+                ex->has_field = true;
+            }
+            end_field(ex);
+            ex->last_delimiter = DELIM_OTHER;
+        }
+    }
+}
+
+// Finds the character closing the group opened at p, skipping nested groups and quotes. Returns
+// NULL if the group is not closed.
+static const char *find_close(const char *p) {
+    char open = *p;
+    if (open == '`') {
+        for (p++; *p != '\0'; p++) {
+            if (*p == '\\' && p[1] != '\0') {
+                p++;
+            } else if (*p == '`') {
+                return p;
+            }
+        }
+        return NULL;
+    }
+
+    char close = open == '(' ? ')' : '}';
+    int depth = 0;
+    for (; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (*p == open) {
+            depth++;
+        } else if (*p == close) {
+            if (--depth == 0) {
+                return p;
+            }
+        } else if (*p == '`') {
+            p = find_close(p);
+        } else if (*p == '\'') {
+            p = strchr(p + 1, '\'');
+        } else if (*p == '\"') {
+            for (p++; *p != '\0' && *p != '\"'; p++) {
+                if (*p == '\\' && p[1] != '\0') {
+                    p++;
+                }
+            }
+            if (*p == '\0') {
+                p = NULL;
+            }
+        }
+        if (p == NULL) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static void add_substitution(Expander *ex, const char *text, bool quoted) {
+    char *output = command_substitution(text);
+    add_expansion(ex, output, quoted);
+    free(output);
+}
+
+static void add_number(Expander *ex, long number, bool quoted) {
+    char value[32];
+    snprintf(value, sizeof(value), "%ld", number);
+    add_expansion(ex, value, quoted);
+}
+
+// Expands the parameters and command substitutions in an arithmetic expression, then evaluates it.
+static void arithmetic(Expander *ex, const char *text, bool quoted) {
+    char *expression = expand_word(text);
+    int64_t result;
+    if (expression == NULL || !arith_evaluate(expression, &result)) {
+        ex->failed = true;
+    } else {
+        char value[32];
+        snprintf(value, sizeof(value), "%" PRId64, result);
+        add_expansion(ex, value, quoted);
+    }
+    free(expression);
+}
+
+static bool is_special_param(char c) {
+    return c != '\0' && strchr("?$!#@*-0123456789", c) != NULL;
+}
+
+static bool is_pipestatus(const char *name, size_t length) {
+    return length == 10 && strncmp(name, "PIPESTATUS", 10) == 0;
+}
+
+// Returns the number of elements of an array. A plain variable that is set counts as an array of
+// one element.
+static size_t array_size(const char *name, size_t length) {
+    if (is_pipestatus(name, length)) {
+        size_t size;
+        get_pipestatus(&size);
+        return size;
+    }
+    char *key = xstrndup(name, length);
+    const PtrArray *elements = var_get_array(key);
+    size_t size = elements != NULL ? ptr_array_get_size(elements) : var_get(key) != NULL;
+    free(key);
+    return size;
+}
+
+// Returns an element of an array as a dynamically allocated string, or NULL if it is unset.
+static char *array_element(const char *name, size_t length, size_t i) {
+    if (is_pipestatus(name, length)) {
+        size_t size;
+        const int *statuses = get_pipestatus(&size);
+        if (i >= size) {
+            return NULL;
+        }
+        char number[32];
+        snprintf(number, sizeof(number), "%d", statuses[i]);
+        return xstrdup(number);
+    }
+
+    char *key = xstrndup(name, length);
+    const PtrArray *elements = var_get_array(key);
+    const char *value = NULL;
+    if (elements != NULL) {
+        value = i < ptr_array_get_size(elements) ? ptr_array_get_const(elements, i) : NULL;
+    } else if (i == 0) {
+        value = var_get(key);
+    }
+    free(key);
+    return value != NULL ? xstrdup(value) : NULL;
+}
+
+// Splits NAME[index] into the length of the name and the index. Returns false if there is no index.
+static bool split_subscript(const char *name, size_t length, size_t *name_length,
+                            const char **index, size_t *index_length) {
+    const char *open = memchr(name, '[', length);
+    if (open == NULL || name[length - 1] != ']') {
+        return false;
+    }
+    *name_length = open - name;
+    *index = open + 1;
+    *index_length = name + length - 1 - *index;
+    return true;
+}
+
+static bool is_all_elements(const char *index, size_t length) {
+    return length == 1 && (*index == '@' || *index == '*');
+}
+
+// Evaluates the index of an array element as an arithmetic expression, counting negative indices
+// from the end of the array. Returns false if it is out of range.
+static bool evaluate_index(const char *name, size_t name_length, const char *index, size_t length,
+                           size_t *result) {
+    char *text = xstrndup(index, length);
+    char *expression = expand_word(text);
+    free(text);
+    int64_t i;
+    bool ok = expression != NULL && arith_evaluate(expression, &i);
+    free(expression);
+    if (ok && i < 0) {
+        i += (int64_t)array_size(name, name_length);
+    }
+    *result = (size_t)i;
+    return ok && i >= 0;
+}
+
+// Returns the value of the parameter named by [name, name + length) as a dynamically allocated
+// string, or NULL if it is unset. All the elements of an array are joined with spaces.
+static char *param_value(const char *name, size_t length) {
+    char number[32];
+    if (length == 1 && is_special_param(*name)) {
+        switch (*name) {
+            case '?':
+                snprintf(number, sizeof(number), "%d", get_last_status());
+                return xstrdup(number);
+            case '$':
+                snprintf(number, sizeof(number), "%d", (int)jobs_get_shell_pid());
+                return xstrdup(number);
+            case '!':
+                if (jobs_get_last_background_pid() == 0) {
+                    return NULL;
+                }
+                snprintf(number, sizeof(number), "%d", (int)jobs_get_last_background_pid());
+                return xstrdup(number);
+            case '#':
+                return xstrdup("0");
+            default:
+                // The shell has no positional parameters or option flags to expand.
+                return NULL;
+        }
+    }
+
+    size_t name_length, index_length, i;
+    const char *index;
+    if (!split_subscript(name, length, &name_length, &index, &index_length)) {
+        return array_element(name, length, 0);
+    } else if (is_all_elements(index, index_length)) {
+        size_t size = array_size(name, name_length);
+        if (size == 0) {
+            return NULL;
+        }
+        StrBuf *joined = str_buf_create();
+        for (i = 0; i < size; i++) {
+            char *element = array_element(name, name_length, i);
+            if (i > 0) {
+                str_buf_append_char(joined, ' ');
+            }
+            str_buf_append(joined, element != NULL ? element : "");
+            free(element);
+        }
+        return str_buf_release(joined);
+    } else if (evaluate_index(name, name_length, index, index_length, &i)) {
+        return array_element(name, name_length, i);
+    }
+    return NULL;
+}
+
+static void special_param(Expander *ex, char c, bool quoted) {
+    char *value = param_value(&c, 1);
+    if (value != NULL) {
+        add_expansion(ex, value, quoted);
+        free(value);
+    }
+}
+
+// Expands all the elements of an array. The elements of "${name[@]}" become separate fields.
+static void add_elements(Expander *ex, const char *name, size_t length, char index, bool quoted) {
+    size_t size = array_size(name, length);
+    for (size_t i = 0; i < size; i++) {
+        if (i > 0 && index == '@' && quoted) {
+            end_field(ex);
+        } else if (i > 0) {
+            char separator[2] = {ex->ifs[0], '\0'};
+            add_expansion(ex, separator, quoted);
+        }
+        char *element = array_element(name, length, i);
+        if (element != NULL) {
+            add_expansion(ex, element, quoted);
+            free(element);
+        }
+    }
+}
+
+static void variable(Expander *ex, const char *name, size_t length, bool quoted) {
+    if (is_pipestatus(name, length)) {
+        char *value = array_element(name, length, 0);
+        if (value != NULL) {
+            add_expansion(ex, value, quoted);
+            free(value);
+        }
+        return;
+    }
+    char *key = xstrndup(name, length);
+    const char *value = var_get(key);
+    if (value != NULL) {
+        add_expansion(ex, value, quoted);
+    }
+    free(key);
+}
+
+static void expand(Expander *ex, const char *word);
+
+static void bad_substitution(Expander *ex, const char *start, const char *end) {
+    fprintf(stderr, "${%.*s}: bad substitution\n", (int)(end - start), start);
+    ex->failed = true;
+}
+
+// Finds the end of the parameter name at the start of [p, end): a special parameter, a variable
+// name, or a variable name with a subscript.
+static const char *param_name_end(const char *p, const char *end) {
+    if (p < end && is_special_param(*p)) {
+        return p + 1;
+    }
+    const char *q = p;
+    if (q < end && (isalpha((unsigned char)*q) || *q == '_')) {
+        while (q < end && (isalnum((unsigned char)*q) || *q == '_')) {
+            q++;
+        }
+        const char *close = q < end && *q == '[' ? memchr(q, ']', end - q) : NULL;
+        if (close != NULL) {
+            q = close + 1;
+        }
+    }
+    return q;
+}
+
+// Finds the first occurrence of c in [p, end) outside quotes and nested expansions. Returns end if
+// there is none.
+static const char *find_unquoted(const char *p, const char *end, char c) {
+    while (p < end && *p != c) {
+        const char *close = NULL;
+        if (*p == '\\' && p + 1 < end) {
+            close = p + 1;
+        } else if (*p == '\'') {
+            close = memchr(p + 1, '\'', end - p - 1);
+        } else if (*p == '\"') {
+            close = p + 1;
+            while (close < end && *close != '\"') {
+                close += *close == '\\' && close + 1 < end ? 2 : 1;
+            }
+        } else if (*p == '`') {
+            close = find_close(p);
+        } else if (*p == '$' && p + 1 < end && (p[1] == '(' || p[1] == '{')) {
+            close = find_close(p + 1);
+        } else {
+            close = p;
+        }
+        if (close == NULL || close >= end) {
+            return end;
+        }
+        p = close + 1;
+    }
+    return p;
+}
+
+// Expands [start, end) without field splitting. Returns NULL if the expansion failed.
+static char *expand_range(Expander *ex, const char *start, const char *end) {
+    char *text = xstrndup(start, end - start);
+    char *result = expand_word(text);
+    free(text);
+    if (result == NULL) {
+        ex->failed = true;
+    }
+    return result;
+}
+
+// Expands [start, end) into a glob in which quoted characters are escaped, so that only unquoted
+// ones act as wildcards.
+static Pattern *expand_pattern(Expander *ex, const char *start, const char *end) {
+    Expander sub;
+    init(&sub, false);
+    char *text = xstrndup(start, end - start);
+    expand(&sub, text);
+    free(text);
+    if (sub.failed) {
+        ex->failed = true;
+    }
+    Pattern *pattern = pattern_create(str_buf_get(sub.pattern));
+    finish(&sub);
+    ptr_array_destroy(sub.fields, free);
+    return pattern;
+}
+
+// Expands the word of ${name-word} and the like in place of the parameter. Outside double quotes,
+// the word undergoes field splitting like the rest of the word it is part of.
+static void add_word(Expander *ex, const char *start, const char *end, bool quoted) {
+    if (quoted) {
+        char *value = expand_range(ex, start, end);
+        if (value != NULL) {
+            add_expansion(ex, value, true);
+            free(value);
+        }
+        return;
+    }
+    char *text = xstrndup(start, end - start);
+    bool split_literals = ex->split_literals;
+    ex->split_literals = true;
+    expand(ex, text);
+    ex->split_literals = split_literals;
+    free(text);
+}
+
+// Expands ${name-word}, ${name=word}, ${name?word} and ${name+word}, and their forms with a colon,
+// which also treat an empty value as unset.
+static void default_value(Expander *ex, const char *name, size_t name_length, const char *value,
+                          char op, bool colon, const char *word, const char *end, bool quoted) {
+    bool unset = value == NULL || (colon && *value == '\0');
+    switch (op) {
+        case '-':
+            if (unset) {
+                add_word(ex, word, end, quoted);
+                return;
+            }
+            break;
+        case '=':
+            if (unset) {
+                char *key = xstrndup(name, name_length);
+                char *new_value = expand_range(ex, word, end);
+                if (!is_valid_name(key)) {
+                    fprintf(stderr, "$%s: cannot assign in this way\n", key);
+                    ex->failed = true;
+                } else if (new_value != NULL && !var_set(key, new_value)) {
+                    ex->failed = true;
+                } else if (new_value != NULL) {
+                    add_expansion(ex, new_value, quoted);
+                }
+                free(new_value);
+                free(key);
+                return;
+            }
+            break;
+        case '?':
+            if (unset) {
+                char *message = word < end ? expand_range(ex, word, end) : NULL;
+                fprintf(stderr, "%.*s: %s\n", (int)name_length, name,
+                        message != NULL ? message : "parameter null or not set");
+                free(message);
+                ex->failed = true;
+                return;
+            }
+            break;
+        case '+':
+            if (!unset) {
+                add_word(ex, word, end, quoted);
+            }
+            return;
+    }
+    add_expansion(ex, value, quoted);
+}
+
+// Expands ${name#pattern}, ${name##pattern}, ${name%pattern} and ${name%%pattern}, which remove the
+// shortest or longest matching prefix or suffix.
+static void remove_affix(Expander *ex, const char *value, const char *op, const char *end,
+                         bool quoted) {
+    bool longest = op[1] == op[0];
+    Pattern *pattern = expand_pattern(ex, op + (longest ? 2 : 1), end);
+    size_t length = strlen(value);
+
+    if (op[0] == '#') {
+        ssize_t prefix_length = pattern_match_prefix(pattern, value, length, longest);
+        add_expansion(ex, value + (prefix_length > 0 ? prefix_length : 0), quoted);
+    } else {
+        ssize_t suffix_start = pattern_match_suffix(pattern, value, length, longest);
+        char *result = xstrndup(value, suffix_start >= 0 ? (size_t)suffix_start : length);
+        add_expansion(ex, result, quoted);
+        free(result);
+    }
+    pattern_destroy(pattern);
+}
+
+// Expands ${name/pattern/string}, which replaces the first match, and its forms // for all matches,
+// /# for a match at the start and /% for a match at the end.
+static void replace(Expander *ex, const char *value, const char *op, const char *end, bool quoted) {
+    char mode = op[1] == '/' || op[1] == '#' || op[1] == '%' ? op[1] : '\0';
+    const char *pattern_start = op + (mode != '\0' ? 2 : 1);
+    const char *pattern_end = find_unquoted(pattern_start, end, '/');
+    Pattern *pattern = expand_pattern(ex, pattern_start, pattern_end);
+    char *replacement = pattern_end < end ? expand_range(ex, pattern_end + 1, end) : xstrdup("");
+    if (replacement == NULL) {
+        pattern_destroy(pattern);
+        return;
+    }
+
+    size_t length = strlen(value);
+    StrBuf *result = str_buf_create();
+    if (pattern_is_empty(pattern)) {
+        str_buf_append(result, value);
+    } else if (mode == '#') {
+        ssize_t prefix_length = pattern_match_prefix(pattern, value, length, true);
+        if (prefix_length >= 0) {
+            str_buf_append(result, replacement);
+        }
+        str_buf_append(result, value + (prefix_length > 0 ? prefix_length : 0));
+    } else if (mode == '%') {
+        ssize_t suffix_start = pattern_match_suffix(pattern, value, length, true);
+        str_buf_append_n(result, value, suffix_start >= 0 ? (size_t)suffix_start : length);
+        if (suffix_start >= 0) {
+            str_buf_append(result, replacement);
+        }
+    } else {
+        size_t i = 0, start, match_length;
+        while (i <= length && pattern_find(pattern, value + i, length - i, &start, &match_length)) {
+            str_buf_append_n(result, value + i, start);
+            str_buf_append(result, replacement);
+            i += start + match_length;
+            if (match_length == 0) {
+                // An empty match would be found again at the same place.
+                if (i < length) {
+                    str_buf_append_char(result, value[i]);
+                }
+                i++;
+            }
+            if (mode != '/') {
+                break;
+            }
+        }
+        if (i < length) {
+            str_buf_append(result, value + i);
+        }
+    }
+
+    add_expansion(ex, str_buf_get(result), quoted);
+    str_buf_destroy(result);
+    free(replacement);
+    pattern_destroy(pattern);
+}
+
+static bool evaluate_range(Expander *ex, const char *start, const char *end, int64_t *result) {
+    char *expression = expand_range(ex, start, end);
+    bool ok = expression != NULL && arith_evaluate(expression, result);
+    free(expression);
+    if (!ok) {
+        ex->failed = true;
+    }
+    return ok;
+}
+
+// Expands ${name:offset} and ${name:offset:length}. A negative offset counts from the end of the
+// value, and a negative length gives the end relative to the end of the value.
+static void substring(Expander *ex, const char *value, const char *offset, const char *end,
+                      bool quoted) {
+    const char *separator = find_unquoted(offset, end, ':');
+    int64_t start, length = (int64_t)strlen(value), stop = length;
+    if (!evaluate_range(ex, offset, separator, &start)) {
+        return;
+    }
+    if (start < 0) {
+        start += length;
+    }
+    if (start < 0 || start > length) {
+        return;
+    }
+
+    if (separator < end) {
+        int64_t count;
+        if (!evaluate_range(ex, separator + 1, end, &count)) {
+            return;
+        }
+        stop = count < 0 ? length + count : (count < length - start ? start + count : length);
+        if (stop < start) {
+            fprintf(stderr, "%.*s: substring expression < 0\n", (int)(end - offset), offset);
+            ex->failed = true;
+            return;
+        }
+    }
+
+    char *result = xstrndup(value + start, stop - start);
+    add_expansion(ex, result, quoted);
+    free(result);
+}
+
+// Expands the parameter between braces in [start, end).
+static void braced_param(Expander *ex, const char *start, const char *end, bool quoted) {
+    // ${#name} is the length of the value, while ${#} alone is a special parameter.
+    if (end - start > 1 && *start == '#') {
+        const char *name_end = param_name_end(start + 1, end);
+        if (name_end != end) {
+            bad_substitution(ex, start, end);
+            return;
+        }
+        size_t name_length, index_length;
+        const char *index;
+        if (split_subscript(start + 1, end - start - 1, &name_length, &index, &index_length) &&
+            is_all_elements(index, index_length)) {
+            // The length of an array is its number of elements.
+            add_number(ex, (long)array_size(start + 1, name_length), quoted);
+            return;
+        }
+        char *value = param_value(start + 1, end - start - 1);
+        add_number(ex, value != NULL ? (long)strlen(value) : 0, quoted);
+        free(value);
+        return;
+    }
+
+    // ${!name} expands the variable whose name is the value of name.
+    char *indirect_name = NULL;
+    if (end - start > 1 && *start == '!') {
+        const char *name_end = param_name_end(start + 1, end);
+        indirect_name = param_value(start + 1, name_end - start - 1);
+        if (indirect_name == NULL || param_name_end(indirect_name, indirect_name +
+                                                    strlen(indirect_name)) !=
+                                         indirect_name + strlen(indirect_name)) {
+            bad_substitution(ex, start, end);
+            free(indirect_name);
+            return;
+        }
+        start = name_end;
+    }
+
+    const char *name = indirect_name != NULL ? indirect_name : start;
+    const char *name_end = indirect_name != NULL ? start : param_name_end(start, end);
+    size_t name_length = indirect_name != NULL ? strlen(indirect_name) : (size_t)(name_end - start);
+    if (name_length == 0) {
+        bad_substitution(ex, start, end);
+        return;
+    }
+
+    const char *op = name_end;
+    size_t array_name_length, index_length;
+    const char *index;
+    if (op == end &&
+        split_subscript(name, name_length, &array_name_length, &index, &index_length) &&
+        is_all_elements(index, index_length)) {
+        add_elements(ex, name, array_name_length, *index, quoted);
+        free(indirect_name);
+        return;
+    }
+
+    char *value = param_value(name, name_length);
+    if (op == end) {
+        if (value != NULL) {
+            add_expansion(ex, value, quoted);
+        }
+    } else if (op[0] == ':' && op + 1 < end && strchr("-=?+", op[1]) != NULL) {
+        default_value(ex, name, name_length, value, op[1], true, op + 2, end, quoted);
+    } else if (strchr("-=?+", op[0]) != NULL) {
+        default_value(ex, name, name_length, value, op[0], false, op + 1, end, quoted);
+    } else if (op[0] == '#' || op[0] == '%') {
+        remove_affix(ex, value != NULL ? value : "", op, end, quoted);
+    } else if (op[0] == '/') {
+        replace(ex, value != NULL ? value : "", op, end, quoted);
+    } else if (op[0] == ':') {
+        substring(ex, value != NULL ? value : "", op + 1, end, quoted);
+    } else {
+        bad_substitution(ex, start, end);
+    }
+
+    free(value);
+    free(indirect_name);
+}
+
+// Expands the text following a '$'. Returns a pointer past the expansion.
+static const char *dollar(Expander *ex, const char *p, bool quoted) {
+    if (*p == '(' || *p == '{') {
+        const char *end = find_close(p);
+        if (end == NULL) {
+            add_char(ex, '$', quoted);
+            return p;
+        }
+        if (*p == '(' && p[1] == '(' && end[-1] == ')') {
+            char *text = xstrndup(p + 2, end - p - 3);
+            arithmetic(ex, text, quoted);
+            free(text);
+        } else if (*p == '(') {
+            char *text = xstrndup(p + 1, end - p - 1);
+            add_substitution(ex, text, quoted);
+            free(text);
+        } else {
+            braced_param(ex, p + 1, end, quoted);
+        }
+        return end + 1;
+    }
+
+    if (is_special_param(*p)) {
+        special_param(ex, *p, quoted);
+        return p + 1;
+    }
+
+    if (isalpha((unsigned char)*p) || *p == '_') {
+        const char *name = p;
+        while (isalnum((unsigned char)*p) || *p == '_') {
+            p++;
+        }
+        variable(ex, name, p - name, quoted);
+        return p;
+    }
+
+    add_char(ex, '$', quoted);
+    return p;
+}
+
+// Expands a process substitution, whose text starts at the '(' at p, into the path of its pipe.
+// Returns a pointer past the substitution.
+static const char *process_substitution_path(Expander *ex, const char *p, bool input) {
+    const char *end = find_close(p);
+    if (end == NULL) {
+        add_char(ex, input ? '<' : '>', false);
+        return p;
+    }
+    char *text = xstrndup(p + 1, end - p - 1);
+    char *path = process_substitution(text, input);
+    free(text);
+    if (path == NULL) {
+        ex->failed = true;
+    } else {
+        add_expansion(ex, path, true);
+        free(path);
+    }
+    return end + 1;
+}
+
+static const char *backquote(Expander *ex, const char *p, bool quoted) {
+    const char *end = find_close(p - 1);
+    if (end == NULL) {
+        add_char(ex, '`', quoted);
+        return p;
+    }
+
+    // Inside backquotes, a backslash only escapes a dollar sign, a backquote or another backslash.
+    StrBuf *text = str_buf_create();
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end && strchr("$`\\", p[1]) != NULL) {
+            p++;
+        }
+        str_buf_append_char(text, *p);
+    }
+    add_substitution(ex, str_buf_get(text), quoted);
+    str_buf_destroy(text);
+    return end + 1;
+}
+
+// Expands the text of a double-quoted string, or of a whole here-document body, where double quotes
+// are ordinary characters.
+static const char *double_quote(Expander *ex, const char *p, bool heredoc) {
+    const char *escapable = heredoc ? "$`\\\n" : "$`\"\\\n";
+    ex->has_field = true;
+    while (*p != '\0' && (heredoc || *p != '\"')) {
+        char c = *p++;
+        if (c == '\\' && *p != '\0' && strchr(escapable, *p) != NULL) {
+            if (*p != '\n') {
+                add_char(ex, *p, true);
+            }
+            p++;
+        } else if (c == '$') {
+            p = dollar(ex, p, true);
+        } else if (c == '`') {
+            p = backquote(ex, p, true);
+        } else {
+            add_char(ex, c, true);
+        }
+    }
+    return *p == '\"' ? p + 1 : p;
+}
+
+// Expands a leading tilde to the home directory of the current or a named user. Returns a pointer
+// past the tilde prefix.
+static const char *tilde(Expander *ex, const char *p) {
+    const char *end = p + 1;
+    while (*end != '\0' && *end != '/') {
+        if (strchr("\'\"\\$`", *end) != NULL) {
+            add_char(ex, '~', false);
+            return p + 1;
+        }
+        end++;
+    }
+
+    const char *dir;
+    if (end == p + 1) {
+        dir = var_get("HOME");
+    } else {
+        char *name = xstrndup(p + 1, end - p - 1);
+        struct passwd *pw = getpwnam(name);
+        free(name);
+        dir = pw != NULL ? pw->pw_dir : NULL;
+    }
+
+    if (dir == NULL) {
+        add_char(ex, '~', false);
+        return p + 1;
+    }
+    add_expansion(ex, dir, true);
+    return end;
+}
+
+static void expand(Expander *ex, const char *word) {
+    const char *p = word;
+    if (*p == '~') {
+        p = tilde(ex, p);
+    }
+
+    while (*p != '\0') {
+        char c = *p++;
+        switch (c) {
+            case '\'': {
+                const char *end = strchr(p, '\'');
+                if (end == NULL) {
+                    end = p + strlen(p);
+                }
+                ex->has_field = true;
+                while (p < end) {
+                    add_char(ex, *p++, true);
+                }
+                if (*p == '\'') {
+                    p++;
+                }
+                break;
+            }
+            case '\"':
+                p = double_quote(ex, p, false);
+                break;
+            case '\\':
+                add_char(ex, *p != '\0' ? *p++ : '\\', true);
+                break;
+            case '$':
+                p = dollar(ex, p, false);
+                break;
+            case '`':
+                p = backquote(ex, p, false);
+                break;
+            case '<':
+            case '>':
+                if (*p == '(') {
+                    p = process_substitution_path(ex, p, c == '<');
+                    break;
+                }
+                // fallthrough
+            default:
+                if (ex->split_literals) {
+                    char literal[2] = {c, '\0'};
+                    add_expansion(ex, literal, false);
+                } else {
+                    add_char(ex, c, false);
+                }
+                break;
+        }
+    }
+}
+
+PtrArray *expand_words(const PtrArray *words) {
+    Expander ex;
+    init(&ex, true);
+
+    size_t num_words = ptr_array_get_size(words);
+    for (size_t i = 0; i < num_words && !ex.failed; i++) {
+        expand(&ex, ptr_array_get_const(words, i));
+        end_field(&ex);
+        ex.last_delimiter = DELIM_NONE;
+    }
+
+    finish(&ex);
+    if (ex.failed) {
+        ptr_array_destroy(ex.fields, free);
+        return NULL;
+    }
+    return ex.fields;
+}
+
+// Returns the text expanded so far, or NULL if the expansion failed, and deallocates the rest.
+static char *finish_word(Expander *ex) {
+    char *result = ex->failed ? NULL : xstrdup(str_buf_get(ex->text));
+    finish(ex);
+    ptr_array_destroy(ex->fields, free);
+    return result;
+}
+
+char *expand_word(const char *word) {
+    Expander ex;
+    init(&ex, false);
+    expand(&ex, word);
+    return finish_word(&ex);
+}
+
+char *expand_heredoc(const char *body) {
+    Expander ex;
+    init(&ex, false);
+    double_quote(&ex, body, true);
+    return finish_word(&ex);
+}
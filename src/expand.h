@@ -0,0 +1,19 @@
+#ifndef CODECRAFTERS_SHELL_EXPAND_H_INCLUDED
+#define CODECRAFTERS_SHELL_EXPAND_H_INCLUDED
+
+#include "ptr_array.h"
+
+// Expands words into fields: tilde expansion, parameter expansion, command substitution,
+// arithmetic expansion, field splitting, pathname expansion and quote removal. Returns NULL after
+// reporting an error if an expansion failed.
+PtrArray *expand_words(const PtrArray *words);
+
+// Expands a single word without field splitting or pathname expansion. Returns a dynamically
+// allocated string, or NULL after reporting an error.
+char *expand_word(const char *word);
+
+// Expands parameters, command substitutions and arithmetic in the body of a here-document. Returns
+// a dynamically allocated string, or NULL after reporting an error.
+char *expand_heredoc(const char *body);
+
+#endif
@@ -0,0 +1,829 @@
+#include "jobs.h"
+#include "audit.h"
+#include "ptr_array.h"
+#include "stats.h"
+#include "xmalloc.h"
+
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct {
+    pid_t pid;
+    int status;
+    bool done;
+    bool stopped;
+    // Resources used by the process and the children that it waited for, once it is done.
+    struct rusage usage;
+    uint64_t start_ns;
+    Job *job;
+} Process;
+
+struct Job {
+    int id;
+    // The id that the job had before fg took it out of the table, which it gets back if it is
+    // stopped again.
+    int former_id;
+    char *text;
+    pid_t pgid;
+    bool background;
+    bool pending;
+    unsigned long order;
+    PtrArray *processes;
+    size_t num_running;
+    size_t num_stopped;
+};
+
+// Children are reaped as soon as SIGCHLD arrives through a signalfd, and their statuses are
+// looked up by pid in an open-addressing table, so reaping costs the same regardless of how many
+// jobs exist. Statuses of finished background processes stay in the table until they are waited
+// for or their pid is reused.
+static struct {
+    bool initialized;
+    bool job_control;
+    bool no_children;
+    pid_t shell_pid;
+    pid_t shell_pgid;
+    pid_t last_background_pid;
+    int signal_fd;
+    int epoll_fd;
+    sigset_t saved_mask;
+    Process **slots;
+    size_t num_slots;
+    size_t num_processes;
+    PtrArray *table;
+    PtrArray *pending;
+    unsigned long order;
+} jobs;
+
+static size_t slot_index(pid_t pid) {
+    return ((size_t)pid * 2654435761u) & (jobs.num_slots - 1);
+}
+
+static size_t find_slot(pid_t pid) {
+    size_t i = slot_index(pid);
+    while (jobs.slots[i] != NULL && jobs.slots[i]->pid != pid) {
+        i = (i + 1) & (jobs.num_slots - 1);
+    }
+    return i;
+}
+
+static Process *process_find(pid_t pid) {
+    if (jobs.num_slots == 0) {
+        return NULL;
+    }
+    return jobs.slots[find_slot(pid)];
+}
+
+static void grow_slots(void) {
+    Process **old_slots = jobs.slots;
+    size_t old_num_slots = jobs.num_slots;
+
+    jobs.num_slots = old_num_slots == 0 ? 64 : old_num_slots * 2;
+    jobs.slots = xmalloc(sizeof(Process *) * jobs.num_slots);
+    for (size_t i = 0; i < jobs.num_slots; i++) {
+        jobs.slots[i] = NULL;
+    }
+
+    for (size_t i = 0; i < old_num_slots; i++) {
+        if (old_slots[i] != NULL) {
+            jobs.slots[find_slot(old_slots[i]->pid)] = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+static void process_insert(Process *process) {
+    if ((jobs.num_processes + 1) * 4 > jobs.num_slots * 3) {
+        grow_slots();
+    }
+
+    size_t i = find_slot(process->pid);
+    if (jobs.slots[i] != NULL) {
+        // The pid was reused, so the remembered status of its previous owner is stale. A process
+        // still listed in a job is freed with the job instead.
+        if (jobs.slots[i]->job == NULL) {
+            free(jobs.slots[i]);
+        }
+    } else {
+        jobs.num_processes++;
+    }
+    jobs.slots[i] = process;
+}
+
+static void process_remove(Process *process) {
+    size_t mask = jobs.num_slots - 1;
+    size_t i = find_slot(process->pid);
+    if (jobs.slots[i] != process) {
+        return;
+    }
+    jobs.slots[i] = NULL;
+    jobs.num_processes--;
+
+    // Shift later entries of the probe sequence back so that lookups never stop at the hole.
+    for (size_t j = (i + 1) & mask; jobs.slots[j] != NULL; j = (j + 1) & mask) {
+        size_t k = slot_index(jobs.slots[j]->pid);
+        bool in_place = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        if (!in_place) {
+            jobs.slots[i] = jobs.slots[j];
+            jobs.slots[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+static int exit_status(const Process *process) {
+    if (process->stopped) {
+        return 128 + WSTOPSIG(process->status);
+    } else if (!process->done) {
+        return 127;
+    } else if (WIFSIGNALED(process->status)) {
+        return 128 + WTERMSIG(process->status);
+    }
+    return WEXITSTATUS(process->status);
+}
+
+static const Process *last_process(const Job *job) {
+    return ptr_array_get_const(job->processes, ptr_array_get_size(job->processes) - 1);
+}
+
+static bool is_stopped(const Job *job) {
+    return job->num_stopped > 0 && job->num_stopped == job->num_running;
+}
+
+static bool is_done(const Job *job) {
+    return job->num_running == 0;
+}
+
+static void mark_pending(Job *job) {
+    if (job->id != 0 && !job->pending) {
+        job->pending = true;
+        ptr_array_append(jobs.pending, job);
+    }
+}
+
+static void remove_from_table(Job *job) {
+    if (job->pending) {
+        size_t num_pending = ptr_array_get_size(jobs.pending);
+        for (size_t i = 0; i < num_pending; i++) {
+            if (ptr_array_get(jobs.pending, i) == job) {
+                ptr_array_set(jobs.pending, i, ptr_array_get(jobs.pending, num_pending - 1));
+                ptr_array_pop(jobs.pending);
+                break;
+            }
+        }
+        job->pending = false;
+    }
+
+    if (job->id != 0) {
+        ptr_array_set(jobs.table, job->id - 1, NULL);
+        while (!ptr_array_is_empty(jobs.table) &&
+               ptr_array_get(jobs.table, ptr_array_get_size(jobs.table) - 1) == NULL) {
+            ptr_array_pop(jobs.table);
+        }
+        job->former_id = job->id;
+        job->id = 0;
+    }
+}
+
+static void add_to_table(Job *job) {
+    size_t id = job->former_id;
+    size_t num_jobs = ptr_array_get_size(jobs.table);
+    if (id == 0 || (id <= num_jobs && ptr_array_get(jobs.table, id - 1) != NULL)) {
+        ptr_array_append(jobs.table, job);
+        id = num_jobs + 1;
+    } else {
+        while (ptr_array_get_size(jobs.table) < id) {
+            ptr_array_append(jobs.table, NULL);
+        }
+        ptr_array_set(jobs.table, id - 1, job);
+    }
+    job->id = id;
+    job->order = ++jobs.order;
+}
+
+static void nothing(void *ptr) {}
+
+// Deallocates memory for a job. Statuses of its finished processes are kept for the wait builtin if
+// remember is set.
+static void job_destroy(Job *job, bool remember) {
+    remove_from_table(job);
+
+    size_t num_processes = ptr_array_get_size(job->processes);
+    for (size_t i = 0; i < num_processes; i++) {
+        Process *process = ptr_array_get(job->processes, i);
+        if (remember && process->done && process_find(process->pid) == process) {
+            process->job = NULL;
+        } else {
+            process_remove(process);
+            free(process);
+        }
+    }
+
+    ptr_array_destroy(job->processes, nothing);
+    free(job->text);
+    free(job);
+}
+
+static void update(Process *process, int status, const struct rusage *usage) {
+    Job *job = process->job;
+    if (WIFSTOPPED(status)) {
+        process->status = status;
+        if (!process->stopped && job != NULL) {
+            job->num_stopped++;
+        }
+        process->stopped = true;
+    } else if (WIFCONTINUED(status)) {
+        if (process->stopped && job != NULL) {
+            job->num_stopped--;
+        }
+        process->stopped = false;
+    } else {
+        process->status = status;
+        process->usage = *usage;
+        process->done = true;
+        audit_process(process->pid, process->start_ns, status, usage);
+        if (job != NULL) {
+            if (process->stopped) {
+                job->num_stopped--;
+            }
+            job->num_running--;
+        }
+        process->stopped = false;
+    }
+
+    if (job != NULL && (is_done(job) || is_stopped(job))) {
+        mark_pending(job);
+    }
+}
+
+static void ensure_supervisor(void) {
+    if (jobs.initialized) {
+        return;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &jobs.saved_mask);
+
+    jobs.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (jobs.signal_fd < 0) {
+        err(EXIT_FAILURE, "signalfd");
+    }
+    jobs.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (jobs.epoll_fd < 0) {
+        err(EXIT_FAILURE, "epoll_create1");
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = jobs.signal_fd};
+    if (epoll_ctl(jobs.epoll_fd, EPOLL_CTL_ADD, jobs.signal_fd, &event) < 0) {
+        err(EXIT_FAILURE, "epoll_ctl");
+    }
+
+    jobs.initialized = true;
+}
+
+static void reap(void) {
+    if (!jobs.initialized) {
+        return;
+    }
+
+    // Drain the signalfd before calling waitpid() so that a child exiting in between is not missed.
+    struct signalfd_siginfo info[16];
+    while (read(jobs.signal_fd, info, sizeof(info)) > 0) {
+    }
+
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        Process *process = process_find(pid);
+        if (process != NULL) {
+            update(process, status, &usage);
+        }
+    }
+    jobs.no_children = pid < 0 && errno == ECHILD;
+}
+
+static void wait_for_children(void) {
+    struct epoll_event event;
+    while (epoll_wait(jobs.epoll_fd, &event, 1, -1) < 0 && errno == EINTR) {
+    }
+    reap();
+}
+
+static void forget_all_jobs(void) {
+    while (!ptr_array_is_empty(jobs.table)) {
+        Job *job = ptr_array_get(jobs.table, ptr_array_get_size(jobs.table) - 1);
+        if (job != NULL) {
+            job_destroy(job, false);
+        } else {
+            ptr_array_pop(jobs.table);
+        }
+    }
+    for (size_t i = 0; i < jobs.num_slots; i++) {
+        free(jobs.slots[i]);
+    }
+    free(jobs.slots);
+    jobs.slots = NULL;
+    jobs.num_slots = 0;
+    jobs.num_processes = 0;
+}
+
+// Prepares a freshly forked child. The child is not a supervisor of the shell's jobs, so it drops
+// them and restores the signal state that the shell changed.
+static void reset_in_child(const Job *job) {
+    if (jobs.job_control) {
+        setpgid(0, job->pgid);
+        if (!job->background) {
+            tcsetpgrp(STDIN_FILENO, getpgrp());
+        }
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        jobs.job_control = false;
+    } else if (job->background) {
+        int fd = open("/dev/null", O_RDONLY);
+        if (fd >= 0) {
+            dup2(fd, STDIN_FILENO);
+            close(fd);
+        }
+    }
+
+    if (jobs.initialized) {
+        close(jobs.signal_fd);
+        close(jobs.epoll_fd);
+        sigprocmask(SIG_SETMASK, &jobs.saved_mask, NULL);
+        jobs.initialized = false;
+    }
+    forget_all_jobs();
+}
+
+void jobs_init(void) {
+    jobs.shell_pid = getpid();
+    jobs.table = ptr_array_create();
+    jobs.pending = ptr_array_create();
+
+    if (!isatty(STDIN_FILENO) || tcgetpgrp(STDIN_FILENO) < 0) {
+        return;
+    }
+
+    // Wait until the shell is in the foreground before taking over the terminal.
+    while (tcgetpgrp(STDIN_FILENO) != getpgrp()) {
+        kill(-getpgrp(), SIGTTIN);
+    }
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    jobs.shell_pgid = getpid();
+    setpgid(0, jobs.shell_pgid);
+    if (tcsetpgrp(STDIN_FILENO, jobs.shell_pgid) == 0) {
+        jobs.job_control = true;
+    }
+}
+
+Job *job_create(const char *text, bool background) {
+    Job *job = xmalloc(sizeof(Job));
+    job->id = 0;
+    job->former_id = 0;
+    job->text = xstrdup(text);
+    job->pgid = 0;
+    job->background = background;
+    job->pending = false;
+    job->order = 0;
+    job->processes = ptr_array_create();
+    job->num_running = 0;
+    job->num_stopped = 0;
+    return job;
+}
+
+pid_t job_fork(Job *job) {
+    ensure_supervisor();
+
+    // Anything still buffered would otherwise be written a second time by the child.
+    fflush(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        err(EXIT_FAILURE, "fork");
+    } else if (pid == 0) {
+        reset_in_child(job);
+        return 0;
+    }
+
+    stats_add(STAT_FORKS, 1);
+    jobs.no_children = false;
+    if (job->pgid == 0) {
+        job->pgid = pid;
+    }
+    if (jobs.job_control) {
+        setpgid(pid, job->pgid);
+    }
+
+    Process *process = xmalloc(sizeof(Process));
+    process->pid = pid;
+    process->status = 0;
+    process->done = false;
+    process->stopped = false;
+    memset(&process->usage, 0, sizeof(process->usage));
+    process->start_ns = audit_now();
+    process->job = job;
+    process_insert(process);
+    ptr_array_append(job->processes, process);
+    job->num_running++;
+    return pid;
+}
+
+static void find_current_jobs(const Job **current, const Job **previous) {
+    *current = *previous = NULL;
+    size_t num_jobs = ptr_array_get_size(jobs.table);
+    for (size_t i = 0; i < num_jobs; i++) {
+        const Job *job = ptr_array_get_const(jobs.table, i);
+        if (job == NULL) {
+            continue;
+        }
+        if (*current == NULL || job->order > (*current)->order) {
+            *previous = *current;
+            *current = job;
+        } else if (*previous == NULL || job->order > (*previous)->order) {
+            *previous = job;
+        }
+    }
+}
+
+// Prints the state of a job, marking it if it is the current or previous one, which the caller
+// finds once for all the jobs that it lists.
+static void print_job(const Job *job, const Job *current, const Job *previous, bool with_pid) {
+    char marker = job == current ? '+' : job == previous ? '-' : ' ';
+
+    char state[32];
+    const Process *last = last_process(job);
+    if (!is_done(job)) {
+        snprintf(state, sizeof(state), "%s", is_stopped(job) ? "Stopped" : "Running");
+    } else if (WIFSIGNALED(last->status)) {
+        snprintf(state, sizeof(state), "%s", strsignal(WTERMSIG(last->status)));
+    } else if (WEXITSTATUS(last->status) != 0) {
+        snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(last->status));
+    } else {
+        snprintf(state, sizeof(state), "Done");
+    }
+
+    printf("[%d]%c  ", job->id, marker);
+    if (with_pid) {
+        printf("%d ", (int)last->pid);
+    }
+    printf("%-24s%s%s\n", state, job->text, is_done(job) || is_stopped(job) ? "" : " &");
+}
+
+int job_wait(Job *job, int *statuses) {
+    // A pipeline can fail to start its first process.
+    if (ptr_array_is_empty(job->processes)) {
+        job_destroy(job, false);
+        return 0;
+    }
+
+    bool owns_terminal = jobs.job_control && !job->background;
+    if (owns_terminal) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+
+    reap();
+    while (!is_done(job) && !is_stopped(job) && !jobs.no_children) {
+        wait_for_children();
+    }
+
+    if (owns_terminal) {
+        tcsetpgrp(STDIN_FILENO, jobs.shell_pgid);
+    }
+
+    size_t num_processes = ptr_array_get_size(job->processes);
+    for (size_t i = 0; i < num_processes; i++) {
+        statuses[i] = exit_status(ptr_array_get_const(job->processes, i));
+    }
+
+    if (is_stopped(job)) {
+        job->background = true;
+        add_to_table(job);
+        printf("\n");
+        const Job *current, *previous;
+        find_current_jobs(&current, &previous);
+        print_job(job, current, previous, false);
+    } else {
+        job_destroy(job, false);
+    }
+    return statuses[num_processes - 1];
+}
+
+bool job_is_done(const Job *job) {
+    return is_done(job);
+}
+
+static void add_time(struct timeval *sum, const struct timeval *time) {
+    sum->tv_sec += time->tv_sec;
+    sum->tv_usec += time->tv_usec;
+    if (sum->tv_usec >= 1000000) {
+        sum->tv_sec++;
+        sum->tv_usec -= 1000000;
+    }
+}
+
+void job_get_usage(const Job *job, struct rusage *usage) {
+    memset(usage, 0, sizeof(*usage));
+    size_t num_processes = ptr_array_get_size(job->processes);
+    for (size_t i = 0; i < num_processes; i++) {
+        const struct rusage *process_usage =
+            &((const Process *)ptr_array_get_const(job->processes, i))->usage;
+        add_time(&usage->ru_utime, &process_usage->ru_utime);
+        add_time(&usage->ru_stime, &process_usage->ru_stime);
+        if (process_usage->ru_maxrss > usage->ru_maxrss) {
+            usage->ru_maxrss = process_usage->ru_maxrss;
+        }
+        usage->ru_minflt += process_usage->ru_minflt;
+        usage->ru_majflt += process_usage->ru_majflt;
+        usage->ru_inblock += process_usage->ru_inblock;
+        usage->ru_oublock += process_usage->ru_oublock;
+        usage->ru_nvcsw += process_usage->ru_nvcsw;
+        usage->ru_nivcsw += process_usage->ru_nivcsw;
+    }
+}
+
+int jobs_get_event_fd(void) {
+    ensure_supervisor();
+    return jobs.epoll_fd;
+}
+
+void jobs_wait_for_children(void) {
+    reap();
+    if (!jobs.no_children) {
+        wait_for_children();
+    }
+}
+
+void job_kill(const Job *job, int sig) {
+    size_t num_processes = ptr_array_get_size(job->processes);
+    for (size_t i = 0; i < num_processes; i++) {
+        const Process *process = ptr_array_get_const(job->processes, i);
+        if (!process->done) {
+            kill(process->pid, sig);
+        }
+    }
+}
+
+void job_background(Job *job) {
+    add_to_table(job);
+    jobs.last_background_pid = last_process(job)->pid;
+    if (jobs.job_control) {
+        printf("[%d] %d\n", job->id, (int)jobs.last_background_pid);
+    }
+    if (is_done(job)) {
+        mark_pending(job);
+    }
+}
+
+void jobs_notify(void) {
+    reap();
+
+    const Job *current, *previous;
+    find_current_jobs(&current, &previous);
+    size_t num_pending = ptr_array_get_size(jobs.pending);
+    for (size_t i = 0; i < num_pending; i++) {
+        Job *job = ptr_array_get(jobs.pending, i);
+        job->pending = false;
+        if (jobs.job_control) {
+            print_job(job, current, previous, false);
+        }
+    }
+    // Jobs are destroyed only after all are printed, as current and previous may be among them.
+    for (size_t i = 0; i < num_pending; i++) {
+        Job *job = ptr_array_get(jobs.pending, i);
+        if (is_done(job)) {
+            job_destroy(job, true);
+        }
+    }
+    while (!ptr_array_is_empty(jobs.pending)) {
+        ptr_array_pop(jobs.pending);
+    }
+}
+
+pid_t jobs_get_shell_pid(void) {
+    return jobs.shell_pid;
+}
+
+pid_t jobs_get_last_background_pid(void) {
+    return jobs.last_background_pid;
+}
+
+// Finds the job denoted by a job spec such as %1, %+, %- or %prefix. A missing spec denotes the
+// current job.
+static Job *find_job(const char *spec) {
+    const Job *current, *previous;
+    find_current_jobs(&current, &previous);
+
+    if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 ||
+        strcmp(spec, "%") == 0) {
+        return (Job *)current;
+    } else if (strcmp(spec, "%-") == 0) {
+        return (Job *)previous;
+    } else if (spec[0] != '%') {
+        return NULL;
+    }
+
+    if (isdigit((unsigned char)spec[1])) {
+        size_t id = strtoul(spec + 1, NULL, 10);
+        if (id == 0 || id > ptr_array_get_size(jobs.table)) {
+            return NULL;
+        }
+        return ptr_array_get(jobs.table, id - 1);
+    }
+
+    size_t num_jobs = ptr_array_get_size(jobs.table);
+    size_t prefix_length = strlen(spec + 1);
+    for (size_t i = num_jobs; i > 0; i--) {
+        Job *job = ptr_array_get(jobs.table, i - 1);
+        if (job != NULL && strncmp(job->text, spec + 1, prefix_length) == 0) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void continue_job(Job *job) {
+    size_t num_processes = ptr_array_get_size(job->processes);
+    for (size_t i = 0; i < num_processes; i++) {
+        Process *process = ptr_array_get(job->processes, i);
+        if (process->stopped) {
+            process->stopped = false;
+            job->num_stopped--;
+            if (!jobs.job_control) {
+                kill(process->pid, SIGCONT);
+            }
+        }
+    }
+    if (jobs.job_control) {
+        kill(-job->pgid, SIGCONT);
+    }
+}
+
+int cmd_jobs(const PtrArray *arguments) {
+    bool with_pid = false, pids_only = false;
+    size_t num_args = ptr_array_get_size(arguments);
+    for (size_t i = 1; i < num_args; i++) {
+        const char *option = ptr_array_get_const(arguments, i);
+        if (strcmp(option, "-l") == 0) {
+            with_pid = true;
+        } else if (strcmp(option, "-p") == 0) {
+            pids_only = true;
+        } else {
+            fprintf(stderr, "jobs: %s: invalid option\n", option);
+            return 2;
+        }
+    }
+
+    reap();
+    const Job *current, *previous;
+    find_current_jobs(&current, &previous);
+    PtrArray *finished = ptr_array_create();
+    size_t num_jobs = ptr_array_get_size(jobs.table);
+    for (size_t i = 0; i < num_jobs; i++) {
+        Job *job = ptr_array_get(jobs.table, i);
+        if (job == NULL) {
+            continue;
+        }
+        if (pids_only) {
+            printf("%d\n", (int)last_process(job)->pid);
+        } else {
+            print_job(job, current, previous, with_pid);
+        }
+        if (is_done(job)) {
+            ptr_array_append(finished, job);
+        }
+    }
+
+    // Finished jobs are reported once, like by the notification before the prompt.
+    size_t num_finished = ptr_array_get_size(finished);
+    for (size_t i = 0; i < num_finished; i++) {
+        job_destroy(ptr_array_get(finished, i), true);
+    }
+    ptr_array_destroy(finished, nothing);
+    return 0;
+}
+
+static int wait_for_pid(const char *operand) {
+    char *end;
+    long pid = strtol(operand, &end, 10);
+    if (end == operand || *end != '\0' || pid <= 0) {
+        fprintf(stderr, "wait: `%s': not a pid or valid job spec\n", operand);
+        return 2;
+    }
+
+    Process *process = process_find(pid);
+    if (process == NULL) {
+        fprintf(stderr, "wait: pid %ld is not a child of this shell\n", pid);
+        return 127;
+    }
+
+    reap();
+    while (!process->done && !jobs.no_children) {
+        wait_for_children();
+    }
+    int status = exit_status(process);
+    if (process->job == NULL) {
+        process_remove(process);
+        free(process);
+    }
+    return status;
+}
+
+static int wait_for_job(Job *job) {
+    reap();
+    while (!is_done(job) && !jobs.no_children) {
+        wait_for_children();
+    }
+    int status = exit_status(last_process(job));
+    job_destroy(job, false);
+    return status;
+}
+
+int cmd_wait(const PtrArray *arguments) {
+    size_t num_args = ptr_array_get_size(arguments);
+    if (num_args == 1) {
+        while (!ptr_array_is_empty(jobs.table)) {
+            Job *job = ptr_array_get(jobs.table, ptr_array_get_size(jobs.table) - 1);
+            if (job != NULL) {
+                wait_for_job(job);
+            } else {
+                ptr_array_pop(jobs.table);
+            }
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (size_t i = 1; i < num_args; i++) {
+        const char *operand = ptr_array_get_const(arguments, i);
+        if (operand[0] != '%') {
+            status = wait_for_pid(operand);
+            continue;
+        }
+
+        Job *job = find_job(operand);
+        if (job == NULL) {
+            fprintf(stderr, "wait: %s: no such job\n", operand);
+            status = 127;
+            continue;
+        }
+        status = wait_for_job(job);
+    }
+    return status;
+}
+
+int cmd_fg(const PtrArray *arguments) {
+    const char *spec = ptr_array_get_size(arguments) > 1 ? ptr_array_get_const(arguments, 1) : NULL;
+    Job *job = find_job(spec);
+    if (job == NULL) {
+        fprintf(stderr, "fg: %s: no such job\n", spec != NULL ? spec : "current");
+        return 1;
+    }
+
+    remove_from_table(job);
+    job->background = false;
+    printf("%s\n", job->text);
+    fflush(stdout);
+    continue_job(job);
+
+    int *statuses = xmalloc(sizeof(int) * ptr_array_get_size(job->processes));
+    int status = job_wait(job, statuses);
+    free(statuses);
+    return status;
+}
+
+int cmd_bg(const PtrArray *arguments) {
+    const char *spec = ptr_array_get_size(arguments) > 1 ? ptr_array_get_const(arguments, 1) : NULL;
+    Job *job = find_job(spec);
+    if (job == NULL) {
+        fprintf(stderr, "bg: %s: no such job\n", spec != NULL ? spec : "current");
+        return 1;
+    }
+
+    job->background = true;
+    continue_job(job);
+    printf("[%d] %s &\n", job->id, job->text);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef CODECRAFTERS_SHELL_JOBS_H_INCLUDED
+#define CODECRAFTERS_SHELL_JOBS_H_INCLUDED
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "ptr_array.h"
+
+typedef struct Job Job;
+
+// Records the shell's process ID and, when the shell is interactive, enables job control.
+void jobs_init(void);
+
+// Allocates memory for a job running the given command text.
+Job *job_create(const char *text, bool background);
+
+// Forks a process that belongs to a job. Returns 0 in the child and the child's process ID in the
+// shell. All children of the shell must be created through this function, because the supervisor
+// reaps every child and only keeps the statuses of the ones it knows about.
+pid_t job_fork(Job *job);
+
+// Waits for a foreground job to finish or stop, storing the exit status of each of its processes in
+// statuses. A stopped job is moved to the job table, and a finished one is deallocated. Returns the
+// exit status of the last process, or 0 for a job without any.
+int job_wait(Job *job, int *statuses);
+
+// Checks whether all processes of a job have finished.
+bool job_is_done(const Job *job);
+
+// Sums the resources used by the finished processes of a job. The maximum resident set size is the
+// largest of any one process.
+void job_get_usage(const Job *job, struct rusage *usage);
+
+// Returns a file descriptor that becomes readable when a child of the shell changes state, so that
+// a loop waiting for other events too can call jobs_notify() then.
+int jobs_get_event_fd(void);
+
+// Blocks until a child of the shell changes state, and records its status.
+void jobs_wait_for_children(void);
+
+// Sends a signal to all processes of a job.
+void job_kill(const Job *job, int sig);
+
+// Moves a background job to the job table.
+void job_background(Job *job);
+
+// Reaps children without blocking, reports background jobs that finished or stopped since the last
+// call, and removes finished jobs from the job table.
+void jobs_notify(void);
+
+// Returns the process ID of the shell, which is the same in its forked children.
+pid_t jobs_get_shell_pid(void);
+
+// Returns the process ID of the last process of the most recent background job, or 0 if none.
+pid_t jobs_get_last_background_pid(void);
+
+// Lists the jobs in the job table (the jobs builtin).
+int cmd_jobs(const PtrArray *arguments);
+
+// Waits for background jobs or processes and returns the exit status of the last one (the wait
+// builtin).
+int cmd_wait(const PtrArray *arguments);
+
+// Continues a job in the foreground (the fg builtin).
+int cmd_fg(const PtrArray *arguments);
+
+// Continues a stopped job in the background (the bg builtin).
+int cmd_bg(const PtrArray *arguments);
+
+#endif
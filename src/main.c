@@ -1,49 +1,131 @@
 #include <readline/history.h>
 #include <readline/readline.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "audit.h"
 #include "autocmp.h"
 #include "cmd.h"
+#include "jobs.h"
 #include "parse.h"
 #include "ptr_array.h"
+#include "read.h"
 #include "scan.h"
+#include "server.h"
+#include "speculate.h"
+#include "stats.h"
 #include "token.h"
+#include "var.h"
+#include "xmalloc.h"
+
+// Longer lines, such as generated argument lists, are not kept in history, which would hold a copy
+// of each in memory and in HISTFILE.
+#define MAX_HISTORY_LINE (64 * 1024)
 
 static void write_history_file(void) {
-    const char *histfile = getenv("HISTFILE");
+    // Forked children exit through here too, but only the shell itself owns the history.
+    if (getpid() != jobs_get_shell_pid()) {
+        return;
+    }
+    const char *histfile = var_get("HISTFILE");
     if (histfile != NULL) {
         write_history(histfile);
     }
 }
 
 static void setup(void) {
+    stats_init();
     rl_attempted_completion_function = shell_completion;
+    if (isatty(STDIN_FILENO)) {
+        speculate_init();
+    }
+    vars_init();
+    audit_init();
+    jobs_init();
+    read_init();
 
     using_history();
-    const char *histfile = getenv("HISTFILE");
+    const char *histfile = var_get("HISTFILE");
     if (histfile != NULL) {
         read_history(histfile);
     }
     atexit(write_history_file);
 }
 
-static PtrArray *parse_line_to_cmds(const char *line) {
-    PtrArray *tokens = scan(line);
-    PtrArray *cmds = parse(tokens);
+// Scans a line, appending continuation lines while a here-document is unfinished. Returns NULL if
+// the input ends first.
+static PtrArray *scan_lines(char **line) {
+    PtrArray *tokens;
+    while (true) {
+        uint64_t start_ns = stats_now();
+        tokens = scan(*line);
+        stats_add(STAT_SCAN_NS, stats_now() - start_ns);
+        if (tokens != NULL) {
+            break;
+        } else if (scan_get_error() != NULL) {
+            fprintf(stderr, "syntax error: %s\n", scan_get_error());
+            return NULL;
+        }
+        char *next = readline("> ");
+        if (next == NULL) {
+            fprintf(stderr, "unexpected end of file in here-document\n");
+            return NULL;
+        }
+        size_t length = strlen(*line);
+        *line = xrealloc(*line, length + strlen(next) + 2);
+        (*line)[length] = '\n';
+        strcpy(*line + length + 1, next);
+        free(next);
+    }
+    return tokens;
+}
+
+// Runs a line read from the terminal, recording the time spent in each stage and the allocations
+// made for it.
+static void run_line(char *line) {
+    uint64_t allocations_at_start = stats_get_allocations();
+    PtrArray *tokens = scan_lines(&line);
+    if (strlen(line) <= MAX_HISTORY_LINE) {
+        add_history(line);
+    }
+    free(line);
+    if (tokens == NULL) {
+        set_last_status(2);
+        stats_line_done(allocations_at_start);
+        return;
+    }
+
+    uint64_t start_ns = stats_now();
+    PtrArray *pipelines = parse(tokens);
     ptr_array_destroy(tokens, token_destroy);
-    return cmds;
+    stats_add(STAT_PARSE_NS, stats_now() - start_ns);
+    if (pipelines != NULL) {
+        start_ns = stats_now();
+        execute_pipelines(pipelines);
+        ptr_array_destroy(pipelines, pipeline_destroy);
+        stats_add(STAT_EXECUTE_NS, stats_now() - start_ns);
+        jobs_notify();
+    } else {
+        set_last_status(2);
+    }
+    stats_line_done(allocations_at_start);
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    if (argc != 1 && (argc != 3 || strcmp(argv[1], "--server") != 0)) {
+        fprintf(stderr, "usage: %s [--server PATH]\n", argv[0]);
+        return 2;
+    }
     setup();
+    if (argc == 3) {
+        server_run(argv[2]);
+    }
 
     char *line;
     while ( (line = readline("$ ")) != NULL) {
-        add_history(line);
-        PtrArray *cmds = parse_line_to_cmds(line);
-        free(line);
-        execute_cmds(cmds);
-        ptr_array_destroy(cmds, cmd_destroy);
+        run_line(line);
     }
 
     exit(EXIT_SUCCESS);
@@ -1,8 +1,14 @@
 #include "misc.h"
 #include "ptr_array.h"
+#include "stats.h"
+#include "var.h"
 #include "xmalloc.h"
 
+#include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,7 +24,12 @@ const PtrArray *get_all_builtin_names(void) {
 
     builtins = ptr_array_create();
 
-    static const char *names[] = {"cd", "echo", "exit", "history", "pwd", "type"};
+    static const char *names[] = {".",        ":",       "[",         "bg",     "cat",
+                                  "cd",       "echo",    "exit",      "export", "false",
+                                  "fg",       "history", "jobs",      "local",  "mapfile",
+                                  "parallel", "printf",  "pwd",       "read",   "readarray",
+                                  "readonly", "set",     "shellstat", "source", "test",
+                                  "true",     "type",    "unset",     "wait"};
     static size_t num_builtins = sizeof(names) / sizeof(const char *);
     for (size_t i = 0; i < num_builtins; i++) {
         ptr_array_append(builtins, xstrdup(names[i]));
@@ -38,6 +49,18 @@ bool is_builtin(const char *cmd_name) {
     return false;
 }
 
+bool is_valid_name(const char *name) {
+    if (!isalpha((unsigned char)name[0]) && name[0] != '_') {
+        return false;
+    }
+    for (const char *p = name + 1; *p != '\0'; p++) {
+        if (!isalnum((unsigned char)*p) && *p != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
 static char *path_join(const char *dir, const char *name) {
     size_t size = strlen(dir) + strlen(name) + 2;
     char *path = xmalloc(size);
@@ -45,20 +68,31 @@ static char *path_join(const char *dir, const char *name) {
     return path;
 }
 
-static bool is_executable(const char *path) {
+bool is_executable(const char *path) {
     struct stat st;
     return stat(path, &st) == 0 && !S_ISDIR(st.st_mode) && access(path, X_OK) == 0;
 }
 
+static bool is_readable_file(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, R_OK) == 0;
+}
+
 static const PtrArray *split_path_to_dirs(void) {
     static PtrArray *dirs = NULL;
-    if (dirs != NULL) {
+    static unsigned long path_generation;
+    if (dirs != NULL && path_generation == var_get_path_generation()) {
         return dirs;
     }
 
+    if (dirs != NULL) {
+        ptr_array_destroy(dirs, free);
+    }
     dirs = ptr_array_create();
+    path_generation = var_get_path_generation();
 
-    char *path = xstrdup(getenv("PATH"));
+    const char *path_value = var_get("PATH");
+    char *path = xstrdup(path_value != NULL ? path_value : "");
     for (char *dir = strtok(path, ":"); dir != NULL; dir = strtok(NULL, ":")) {
         ptr_array_append(dirs, xstrdup(dir));
     }
@@ -67,13 +101,62 @@ static const PtrArray *split_path_to_dirs(void) {
     return dirs;
 }
 
-char *find_executable(const char *name) {
+typedef struct {
+    char *name;
+    char *path;
+} CachedPath;
+
+static void cached_path_destroy(void *ptr) {
+    CachedPath *cached = ptr;
+    free(cached->name);
+    free(cached->path);
+    free(cached);
+}
+
+// Returns the paths that find_executable() found since PATH last changed.
+static PtrArray *get_cached_paths(void) {
+    static PtrArray *cached_paths = NULL;
+    static unsigned long path_generation;
+    if (cached_paths != NULL && path_generation != var_get_path_generation()) {
+        ptr_array_destroy(cached_paths, cached_path_destroy);
+        cached_paths = NULL;
+    }
+    if (cached_paths == NULL) {
+        cached_paths = ptr_array_create();
+        path_generation = var_get_path_generation();
+    }
+    return cached_paths;
+}
+
+static char *search_executable(const char *name) {
+    // A cached path costs one check instead of one per directory, and is searched for again once
+    // it is no longer executable.
+    PtrArray *cached_paths = get_cached_paths();
+    size_t num_cached = ptr_array_get_size(cached_paths);
+    for (size_t i = 0; i < num_cached; i++) {
+        CachedPath *cached = ptr_array_get(cached_paths, i);
+        if (strcmp(cached->name, name) != 0) {
+            continue;
+        } else if (is_executable(cached->path)) {
+            stats_add(STAT_LOOKUP_HITS, 1);
+            return xstrdup(cached->path);
+        }
+        ptr_array_set(cached_paths, i, ptr_array_get(cached_paths, num_cached - 1));
+        ptr_array_pop(cached_paths);
+        cached_path_destroy(cached);
+        break;
+    }
+
     const PtrArray *dirs = split_path_to_dirs();
     size_t num_dirs = ptr_array_get_size(dirs);
     for (size_t i = 0; i < num_dirs; i++) {
         const char *dir = ptr_array_get_const(dirs, i);
         char *path = path_join(dir, name);
         if (is_executable(path)) {
+            CachedPath *cached = xmalloc(sizeof(CachedPath));
+            cached->name = xstrdup(name);
+            cached->path = xstrdup(path);
+            ptr_array_append(cached_paths, cached);
             return path;
         }
         free(path);
@@ -81,36 +164,220 @@ char *find_executable(const char *name) {
     return NULL;
 }
 
-static void add_executable_names_under_dir(const char *dir, PtrArray *executables) {
-    struct dirent **names;
-    int num_names = scandir(dir, &names, NULL, alphasort);
-    if (num_names < 0) {
-        return;
+char *find_executable(const char *name) {
+    uint64_t start_ns = stats_now();
+    char *path = search_executable(name);
+    stats_lookup_done(start_ns);
+    return path;
+}
+
+PtrArray *get_executable_candidates(const char *name) {
+    PtrArray *candidates = ptr_array_create();
+    const PtrArray *dirs = split_path_to_dirs();
+    size_t num_dirs = ptr_array_get_size(dirs);
+    for (size_t i = 0; i < num_dirs; i++) {
+        ptr_array_append(candidates, path_join(ptr_array_get_const(dirs, i), name));
     }
+    return candidates;
+}
 
-    for (int i = 0; i < num_names; i++) {
-        char *path = path_join(dir, names[i]->d_name);
-        if (is_executable(path)) {
-            ptr_array_append(executables, xstrdup(names[i]->d_name));
+void remember_executable(const char *name, const char *path) {
+    PtrArray *cached_paths = get_cached_paths();
+    size_t num_cached = ptr_array_get_size(cached_paths);
+    for (size_t i = 0; i < num_cached; i++) {
+        const CachedPath *cached = ptr_array_get_const(cached_paths, i);
+        if (strcmp(cached->name, name) == 0) {
+            return;
+        }
+    }
+    CachedPath *cached = xmalloc(sizeof(CachedPath));
+    cached->name = xstrdup(name);
+    cached->path = xstrdup(path);
+    ptr_array_append(cached_paths, cached);
+}
+
+char *find_readable_file(const char *name) {
+    const PtrArray *dirs = split_path_to_dirs();
+    size_t num_dirs = ptr_array_get_size(dirs);
+    for (size_t i = 0; i < num_dirs; i++) {
+        char *path = path_join(ptr_array_get_const(dirs, i), name);
+        if (is_readable_file(path)) {
+            return path;
         }
         free(path);
     }
+    return NULL;
+}
+
+// The most threads that scan PATH directories at once. Scanning waits on the disk more than on the
+// CPU, so it is not limited by the number of CPUs.
+#define MAX_SCAN_THREADS 8
+
+static bool is_dot_or_dot_dot(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// Checks whether a directory entry is an executable that is not a directory. The entry type saves
+// a stat for everything but symbolic links and file systems that do not report types.
+static bool is_executable_entry(int dir_fd, const struct dirent64 *entry) {
+    if (entry->d_type == DT_DIR) {
+        return false;
+    } else if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+        struct stat st;
+        if (fstatat(dir_fd, entry->d_name, &st, 0) < 0 || S_ISDIR(st.st_mode)) {
+            return false;
+        }
+    }
+    // Like access() in is_executable(), this checks with the real user and group IDs.
+    return faccessat(dir_fd, entry->d_name, X_OK, 0) == 0;
+}
+
+// Orders names as alphasort() does for scandir().
+static int compare_names(const void *a, const void *b) {
+    return strcoll(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Returns the names of the executables in an open directory, in sorted order, and closes it.
+// Entries are read in large batches and checked relative to the directory, without building a path
+// for each.
+static PtrArray *scan_executable_names(int dir_fd) {
+    PtrArray *names = ptr_array_create();
+
+    union {
+        char buf[32 * 1024];
+        struct dirent64 align;
+    } entries;
+    ssize_t num_read;
+    while ((num_read = getdents64(dir_fd, entries.buf, sizeof(entries.buf))) > 0) {
+        for (ssize_t pos = 0; pos < num_read;) {
+            const struct dirent64 *entry = (const struct dirent64 *)(entries.buf + pos);
+            pos += entry->d_reclen;
+            if (!is_dot_or_dot_dot(entry->d_name) && is_executable_entry(dir_fd, entry)) {
+                ptr_array_append(names, xstrdup(entry->d_name));
+            }
+        }
+    }
+    close(dir_fd);
+
+    qsort(ptr_array_get_c_array(names), ptr_array_get_size(names), sizeof(char *), compare_names);
+    return names;
+}
+
+// Directories are handed out to the scanning threads in turn, and each one's names go to its own
+// slot, so that the results are combined in PATH order whichever thread finishes first.
+typedef struct {
+    size_t num_dirs;
+    // Negative for directories that are skipped.
+    int *dir_fds;
+    PtrArray **names;
+    atomic_size_t next;
+} Scan;
+
+static void *scan_worker(void *arg) {
+    Scan *scan = arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&scan->next, 1)) < scan->num_dirs) {
+        if (scan->dir_fds[i] >= 0) {
+            scan->names[i] = scan_executable_names(scan->dir_fds[i]);
+        }
+    }
+    return NULL;
+}
+
+static void *scan_thread(void *arg) {
+    scan_worker(arg);
+    stats_thread_done();
+    return NULL;
+}
+
+// Opens the directories of PATH for a scan. A directory reached again, often through a symbolic
+// link such as /bin to /usr/bin, only holds names that an earlier one already provides, so it is
+// skipped. Returns the number of directories to scan.
+static size_t open_dirs(const PtrArray *dirs, Scan *scan) {
+    size_t num_open = 0;
+    struct stat *stats = xmalloc(sizeof(struct stat) * (scan->num_dirs + 1));
+    for (size_t i = 0; i < scan->num_dirs; i++) {
+        scan->names[i] = NULL;
+        int fd = open(ptr_array_get_const(dirs, i), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0 && fstat(fd, &stats[i]) < 0) {
+            close(fd);
+            fd = -1;
+        }
+        for (size_t j = 0; fd >= 0 && j < i; j++) {
+            if (scan->dir_fds[j] >= 0 && stats[j].st_dev == stats[i].st_dev &&
+                stats[j].st_ino == stats[i].st_ino) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        scan->dir_fds[i] = fd;
+        num_open += fd >= 0;
+    }
+    free(stats);
+    return num_open;
 }
 
+static PtrArray *executables = NULL;
+// When the executables were last listed, as returned by stats_now().
+static uint64_t executables_built_ns;
+
 const PtrArray *get_all_executable_names(void) {
-    static PtrArray *executables = NULL;
-    if (executables != NULL) {
+    static unsigned long path_generation;
+    if (executables != NULL && path_generation == var_get_path_generation()) {
         return executables;
     }
 
+    if (executables != NULL) {
+        ptr_array_destroy(executables, free);
+    }
     executables = ptr_array_create();
+    executables_built_ns = stats_now();
+    path_generation = var_get_path_generation();
 
     const PtrArray *dirs = split_path_to_dirs();
     size_t num_dirs = ptr_array_get_size(dirs);
-    for (size_t i = 0; i < num_dirs; i++) {
-        const char *dir = ptr_array_get_const(dirs, i);
-        add_executable_names_under_dir(dir, executables);
+    Scan scan = {
+        .num_dirs = num_dirs,
+        .dir_fds = xmalloc(sizeof(int) * (num_dirs + 1)),
+        .names = xmalloc(sizeof(PtrArray *) * (num_dirs + 1)),
+        .next = 0,
+    };
+    size_t num_open = open_dirs(dirs, &scan);
+
+    // The calling thread scans too, so a single directory needs no other thread.
+    pthread_t threads[MAX_SCAN_THREADS - 1];
+    size_t num_threads = 0;
+    while (num_threads + 1 < num_open && num_threads < MAX_SCAN_THREADS - 1 &&
+           pthread_create(&threads[num_threads], NULL, scan_thread, &scan) == 0) {
+        num_threads++;
+    }
+    scan_worker(&scan);
+    for (size_t i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
     }
 
+    // Names are listed in PATH order, so a name in several directories comes first from the one
+    // that runs.
+    for (size_t i = 0; i < num_dirs; i++) {
+        if (scan.names[i] == NULL) {
+            continue;
+        }
+        size_t num_names = ptr_array_get_size(scan.names[i]);
+        for (size_t j = 0; j < num_names; j++) {
+            ptr_array_append(executables, ptr_array_get(scan.names[i], j));
+        }
+        ptr_array_destroy(scan.names[i], NULL);
+    }
+    free(scan.dir_fds);
+    free(scan.names);
     return executables;
 }
+
+bool get_executable_index_info(size_t *num_names, uint64_t *built_ns) {
+    if (executables == NULL) {
+        return false;
+    }
+    *num_names = ptr_array_get_size(executables);
+    *built_ns = executables_built_ns;
+    return true;
+}
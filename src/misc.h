@@ -2,6 +2,7 @@
 #define CODECRAFTERS_SHELL_MISC_H_INCLUDED
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "ptr_array.h"
 
@@ -11,11 +12,34 @@ const PtrArray *get_all_builtin_names(void);
 // Checks whether a command name is a builtin.
 bool is_builtin(const char *name);
 
+// Checks whether a string is a valid shell variable name.
+bool is_valid_name(const char *name);
+
 // Finds an executable of the given name under the PATH environment variable. Returns a dynamically
-// allocated path to the found executable, or NULL if not found.
+// allocated path to the found executable, or NULL if not found. Found paths are remembered until
+// PATH changes or they stop being executable, as other shells hash them.
 char *find_executable(const char *name);
 
+// Checks whether a path is an executable that is not a directory, as find_executable() requires.
+// Safe to call from any thread.
+bool is_executable(const char *path);
+
+// Returns the paths that find_executable() tries for a name, one per PATH directory, in order.
+PtrArray *get_executable_candidates(const char *name);
+
+// Makes find_executable() return path for name, as if it had found it, unless it already knows a
+// path for the name. The path must come from get_executable_candidates() under the current PATH.
+void remember_executable(const char *name, const char *path);
+
+// Finds a readable regular file of the given name under the PATH environment variable, as the
+// source builtin does. Returns a dynamically allocated path, or NULL if not found.
+char *find_readable_file(const char *name);
+
 // Returns an array of names of all executables under the PATH environment variable.
 const PtrArray *get_all_executable_names(void);
 
+// Gets the number of names that get_all_executable_names() last listed and when, as returned by
+// stats_now(). Returns false if it has not listed them yet.
+bool get_executable_index_info(size_t *num_names, uint64_t *built_ns);
+
 #endif
@@ -0,0 +1,145 @@
+#include "options.h"
+#include "ptr_array.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct {
+    size_t pipe_size;
+    bool pin_stages;
+} options;
+
+size_t options_get_pipe_size(void) {
+    return options.pipe_size;
+}
+
+bool options_get_pin_stages(void) {
+    return options.pin_stages;
+}
+
+static void list_options(void) {
+    printf("%-15s%s\n", "pipepin", options.pin_stages ? "on" : "off");
+    if (options.pipe_size == 0) {
+        printf("%-15s%s\n", "pipesize", "default");
+    } else {
+        printf("%-15s%zu\n", "pipesize", options.pipe_size);
+    }
+}
+
+// Parses a size with an optional K, M or G suffix. Returns false if it is malformed or does not fit
+// in a size_t, rather than letting it wrap around to a small value or 0, which means the default.
+static bool parse_size(const char *value, size_t *size) {
+    if (strcmp(value, "default") == 0) {
+        *size = 0;
+        return true;
+    }
+
+    // strtoull() would negate a leading minus sign and wrap around too.
+    if (!isdigit((unsigned char)*value)) {
+        return false;
+    }
+    errno = 0;
+    char *end;
+    unsigned long long n = strtoull(value, &end, 10);
+    if (errno != 0 || n > SIZE_MAX) {
+        return false;
+    }
+    unsigned shift = 0;
+    switch (toupper((unsigned char)*end)) {
+        case 'G':
+            shift = 30;
+            end++;
+            break;
+        case 'M':
+            shift = 20;
+            end++;
+            break;
+        case 'K':
+            shift = 10;
+            end++;
+            break;
+        default:
+            break;
+    }
+    if (*end != '\0' || n > SIZE_MAX >> shift) {
+        return false;
+    }
+    *size = (size_t)n << shift;
+    return true;
+}
+
+// Checks that the kernel accepts a pipe capacity, so that a bad value is reported once here rather
+// than silently ignored for every pipeline.
+static bool check_pipe_size(size_t size) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        return false;
+    }
+    bool ok = fcntl(fds[1], F_SETPIPE_SZ, (int)size) >= 0;
+    close(fds[0]);
+    close(fds[1]);
+    return ok;
+}
+
+static int set_option(const char *option, bool enable) {
+    const char *value = strchr(option, '=');
+    size_t name_length = value != NULL ? (size_t)(value - option) : strlen(option);
+
+    if (strncmp(option, "pipepin", name_length) == 0 && name_length == 7 && value == NULL) {
+        options.pin_stages = enable;
+        return 0;
+    }
+
+    if (strncmp(option, "pipesize", name_length) == 0 && name_length == 8) {
+        size_t size = 0;
+        if (enable && (value == NULL || !parse_size(value + 1, &size))) {
+            fprintf(stderr, "set: pipesize: expected a size such as 1M\n");
+            return 2;
+        }
+        if (size > 0 && (size > 0x7fffffff || !check_pipe_size(size))) {
+            fprintf(stderr, "set: pipesize: %s: %s\n", value + 1,
+                    size > 0x7fffffff ? strerror(EINVAL) : strerror(errno));
+            return 1;
+        }
+        options.pipe_size = size;
+        return 0;
+    }
+
+    fprintf(stderr, "set: %s: invalid option name\n", option);
+    return 2;
+}
+
+int cmd_set(const PtrArray *arguments) {
+    size_t num_args = ptr_array_get_size(arguments);
+    if (num_args == 1) {
+        list_options();
+        return 0;
+    }
+
+    int status = 0;
+    for (size_t i = 1; i < num_args; i++) {
+        const char *flag = ptr_array_get_const(arguments, i);
+        bool enable = strcmp(flag, "-o") == 0;
+        if (!enable && strcmp(flag, "+o") != 0) {
+            fprintf(stderr, "set: %s: invalid option\n", flag);
+            return 2;
+        }
+        if (i + 1 == num_args) {
+            list_options();
+            return 0;
+        }
+
+        int option_status = set_option(ptr_array_get_const(arguments, ++i), enable);
+        if (option_status != 0) {
+            status = option_status;
+        }
+    }
+    return status;
+}
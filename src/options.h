@@ -0,0 +1,18 @@
+#ifndef CODECRAFTERS_SHELL_OPTIONS_H_INCLUDED
+#define CODECRAFTERS_SHELL_OPTIONS_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ptr_array.h"
+
+// Returns the capacity requested for pipeline pipes, or 0 to keep the system default.
+size_t options_get_pipe_size(void);
+
+// Checks whether consecutive pipeline stages are pinned to neighbouring CPUs.
+bool options_get_pin_stages(void);
+
+// Sets or lists shell options (the set builtin).
+int cmd_set(const PtrArray *arguments);
+
+#endif
@@ -0,0 +1,401 @@
+#include "parallel.h"
+#include "cmd.h"
+#include "jobs.h"
+#include "ptr_array.h"
+#include "str_buf.h"
+#include "var.h"
+#include "xmalloc.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+typedef enum {
+    HALT_NEVER,
+    HALT_SOON,
+    HALT_NOW,
+} HaltMode;
+
+// A running job. Its output is collected in memory files and written out in one piece when it
+// finishes, so the output of concurrent jobs never interleaves.
+typedef struct {
+    Job *job;
+    int out_fd;
+    int err_fd;
+} Slot;
+
+static struct {
+    size_t max_jobs;
+    size_t max_args;
+    bool fill;
+    HaltMode halt;
+    size_t arg_budget;
+    // What each input adds to a command: the copies of the template words that hold {}, in bytes
+    // without the inputs, and the number of {} in them. Without any, inputs are appended instead.
+    size_t context_size;
+    size_t num_placeholders;
+    PtrArray *template;
+    PtrArray *inputs;
+    size_t next_input;
+} scheduler;
+
+static void nothing(void *ptr) {}
+
+static bool parse_count(const char *option, const char *value, size_t *count) {
+    char *end;
+    long n = value != NULL ? strtol(value, &end, 10) : -1;
+    if (value == NULL || end == value || *end != '\0' || n < 0) {
+        fprintf(stderr, "parallel: %s: invalid count\n", option);
+        return false;
+    }
+    *count = n;
+    return true;
+}
+
+// Parses options and splits the remaining arguments into the command template and the inputs.
+// Returns false on error.
+static bool parse_arguments(const PtrArray *arguments) {
+    size_t num_args = ptr_array_get_size(arguments);
+    size_t i = 1;
+    for (; i < num_args; i++) {
+        const char *option = ptr_array_get_const(arguments, i);
+        const char *value = i + 1 < num_args ? ptr_array_get_const(arguments, i + 1) : NULL;
+        if (strcmp(option, "-j") == 0) {
+            if (!parse_count(option, value, &scheduler.max_jobs)) {
+                return false;
+            }
+            i++;
+        } else if (strcmp(option, "-n") == 0) {
+            if (!parse_count(option, value, &scheduler.max_args) || scheduler.max_args == 0) {
+                return false;
+            }
+            i++;
+        } else if (strcmp(option, "-X") == 0) {
+            scheduler.fill = true;
+        } else if (strcmp(option, "--halt") == 0) {
+            if (value != NULL && strcmp(value, "now") == 0) {
+                scheduler.halt = HALT_NOW;
+            } else if (value != NULL && strcmp(value, "soon") == 0) {
+                scheduler.halt = HALT_SOON;
+            } else if (value != NULL && strcmp(value, "never") == 0) {
+                scheduler.halt = HALT_NEVER;
+            } else {
+                fprintf(stderr, "parallel: --halt: expected now, soon or never\n");
+                return false;
+            }
+            i++;
+        } else if (strcmp(option, "--") == 0) {
+            i++;
+            break;
+        } else if (option[0] == '-' && option[1] != '\0') {
+            fprintf(stderr, "parallel: %s: invalid option\n", option);
+            return false;
+        } else {
+            break;
+        }
+    }
+
+    bool has_separator = false;
+    for (; i < num_args; i++) {
+        const char *arg = ptr_array_get_const(arguments, i);
+        if (!has_separator && strcmp(arg, ":::") == 0) {
+            has_separator = true;
+        } else if (has_separator) {
+            ptr_array_append(scheduler.inputs, xstrdup(arg));
+        } else {
+            ptr_array_append(scheduler.template, (void *)arg);
+        }
+    }
+
+    if (ptr_array_is_empty(scheduler.template)) {
+        fprintf(stderr, "parallel: usage: parallel [-j jobs] [-n args | -X] [--halt now|soon] "
+                        "command [arguments] [::: inputs]\n");
+        return false;
+    }
+
+    if (!has_separator) {
+        StrBuf *input = str_buf_create();
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+            str_buf_append_n(input, buf, n);
+        }
+
+        const char *line = str_buf_get(input);
+        const char *end = line + str_buf_get_size(input);
+        while (line < end) {
+            const char *newline = memchr(line, '\n', end - line);
+            if (newline == NULL) {
+                newline = end;
+            }
+            ptr_array_append(scheduler.inputs, xstrndup(line, newline - line));
+            line = newline + 1;
+        }
+        str_buf_destroy(input);
+    }
+    return true;
+}
+
+static size_t count_placeholders(const char *word) {
+    size_t count = 0;
+    for (const char *p = word; (p = strstr(p, "{}")) != NULL; p += 2) {
+        count++;
+    }
+    return count;
+}
+
+// Computes how many bytes of arguments fit in one command, leaving room for the environment and the
+// template words that are passed once within ARG_MAX. The words holding {} are repeated per input,
+// so they are counted in the context of each input instead.
+static size_t compute_arg_budget(void) {
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max <= 0) {
+        arg_max = 131072;
+    }
+
+    size_t used = 4096 + var_get_envp_size();
+    scheduler.context_size = 0;
+    scheduler.num_placeholders = 0;
+    size_t template_size = ptr_array_get_size(scheduler.template);
+    for (size_t i = 0; i < template_size; i++) {
+        const char *word = ptr_array_get_const(scheduler.template, i);
+        size_t num_placeholders = count_placeholders(word);
+        size_t word_size = strlen(word) - 2 * num_placeholders + 1 + sizeof(char *);
+        if (num_placeholders > 0) {
+            scheduler.context_size += word_size;
+            scheduler.num_placeholders += num_placeholders;
+        } else {
+            used += word_size;
+        }
+    }
+    return (size_t)arg_max > used ? (size_t)arg_max - used : 0;
+}
+
+// Takes the next batch of inputs, bounded by the per-job argument count and ARG_MAX. A batch always
+// has at least one input. Returns the number of inputs in the batch.
+static size_t take_batch(void) {
+    size_t num_inputs = ptr_array_get_size(scheduler.inputs);
+    size_t count = 0, size = 0;
+    while (scheduler.next_input + count < num_inputs && count < scheduler.max_args) {
+        const char *input = ptr_array_get_const(scheduler.inputs, scheduler.next_input + count);
+        size_t length = strlen(input);
+        size_t input_size = scheduler.num_placeholders > 0
+                                ? scheduler.context_size + scheduler.num_placeholders * length
+                                : length + 1 + sizeof(char *);
+        if (count > 0 && size + input_size > scheduler.arg_budget) {
+            break;
+        }
+        size += input_size;
+        count++;
+    }
+    return count;
+}
+
+static void append_quoted(StrBuf *buf, const char *s, size_t n) {
+    str_buf_append_char(buf, '\'');
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\'') {
+            str_buf_append(buf, "'\\''");
+        } else {
+            str_buf_append_char(buf, s[i]);
+        }
+    }
+    str_buf_append_char(buf, '\'');
+}
+
+// Builds the command for a batch of inputs. Each template word that holds {} is repeated once per
+// input with {} replaced by it, as in the context replacement of GNU parallel, so every input is an
+// argument of its own; without any {}, the inputs are appended. Every part is quoted, since it has
+// already been expanded once.
+static Cmd *build_cmd(size_t first, size_t count, StrBuf *text) {
+    StrBuf *joined = str_buf_create();
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            str_buf_append_char(joined, ' ');
+        }
+        str_buf_append(joined, ptr_array_get_const(scheduler.inputs, first + i));
+    }
+
+    PtrArray *words = ptr_array_create();
+    bool replaced = false;
+    size_t template_size = ptr_array_get_size(scheduler.template);
+    for (size_t i = 0; i < template_size; i++) {
+        const char *template_word = ptr_array_get_const(scheduler.template, i);
+        bool has_placeholder = strstr(template_word, "{}") != NULL;
+        replaced = replaced || has_placeholder;
+        for (size_t j = 0; j < (has_placeholder ? count : 1); j++) {
+            const char *input = ptr_array_get_const(scheduler.inputs, first + j);
+            const char *p = template_word;
+            StrBuf *word = str_buf_create();
+            const char *brace;
+            while ((brace = strstr(p, "{}")) != NULL) {
+                append_quoted(word, p, brace - p);
+                append_quoted(word, input, strlen(input));
+                p = brace + 2;
+            }
+            append_quoted(word, p, strlen(p));
+            ptr_array_append(words, str_buf_release(word));
+        }
+    }
+
+    str_buf_clear(text);
+    for (size_t i = 0; i < template_size; i++) {
+        str_buf_append(text, ptr_array_get_const(scheduler.template, i));
+        str_buf_append_char(text, ' ');
+    }
+
+    if (!replaced) {
+        for (size_t i = 0; i < count; i++) {
+            const char *input = ptr_array_get_const(scheduler.inputs, first + i);
+            StrBuf *word = str_buf_create();
+            append_quoted(word, input, strlen(input));
+            ptr_array_append(words, str_buf_release(word));
+        }
+    }
+    str_buf_append(text, str_buf_get(joined));
+    str_buf_destroy(joined);
+
+    return cmd_create(words, ptr_array_create());
+}
+
+static void spawn(Slot *slot, size_t first, size_t count) {
+    StrBuf *text = str_buf_create();
+    Cmd *cmd = build_cmd(first, count, text);
+
+    slot->out_fd = memfd_create("parallel-stdout", MFD_CLOEXEC);
+    slot->err_fd = memfd_create("parallel-stderr", MFD_CLOEXEC);
+    slot->job = job_create(str_buf_get(text), true);
+
+    if (job_fork(slot->job) == 0) {
+        if (slot->out_fd >= 0) {
+            dup2(slot->out_fd, STDOUT_FILENO);
+        }
+        if (slot->err_fd >= 0) {
+            dup2(slot->err_fd, STDERR_FILENO);
+        }
+        exit(execute_cmd_in_child(cmd));
+    }
+
+    cmd_destroy(cmd);
+    str_buf_destroy(text);
+}
+
+static void dump_output(int fd, int out_fd) {
+    if (fd < 0) {
+        return;
+    }
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    off_t offset = 0;
+    while (offset < size) {
+        ssize_t n = sendfile(out_fd, fd, &offset, size - offset);
+        if (n > 0) {
+            continue;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n == 0 || (errno != EINVAL && errno != ENOSYS)) {
+            break;
+        }
+
+        char buf[65536];
+        while ((n = pread(fd, buf, sizeof(buf), offset)) > 0) {
+            if (write(out_fd, buf, n) != n) {
+                break;
+            }
+            offset += n;
+        }
+        break;
+    }
+    close(fd);
+}
+
+static int collect(Slot *slot) {
+    int status;
+    job_wait(slot->job, &status);
+    fflush(stdout);
+    dump_output(slot->out_fd, STDOUT_FILENO);
+    dump_output(slot->err_fd, STDERR_FILENO);
+    return status;
+}
+
+// Returns the index of a finished slot, blocking until one finishes.
+static size_t wait_for_slot(Slot *slots, size_t num_running) {
+    for (;;) {
+        for (size_t i = 0; i < num_running; i++) {
+            if (job_is_done(slots[i].job)) {
+                return i;
+            }
+        }
+        jobs_wait_for_children();
+    }
+}
+
+int cmd_parallel(const PtrArray *arguments) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    scheduler.max_jobs = num_cpus > 0 ? num_cpus : 1;
+    scheduler.max_args = 1;
+    scheduler.fill = false;
+    scheduler.halt = HALT_NEVER;
+    scheduler.template = ptr_array_create();
+    scheduler.inputs = ptr_array_create();
+    scheduler.next_input = 0;
+
+    int status = 0;
+    if (!parse_arguments(arguments)) {
+        status = 2;
+        goto done;
+    }
+
+    size_t num_inputs = ptr_array_get_size(scheduler.inputs);
+    if (scheduler.max_jobs == 0) {
+        scheduler.max_jobs = num_inputs > 0 ? num_inputs : 1;
+    }
+    if (scheduler.fill) {
+        // Spread the inputs evenly over the job slots, as far as ARG_MAX allows.
+        scheduler.max_args = (num_inputs + scheduler.max_jobs - 1) / scheduler.max_jobs;
+    }
+    scheduler.arg_budget = compute_arg_budget();
+
+    Slot *slots = xmalloc(sizeof(Slot) * scheduler.max_jobs);
+    size_t num_running = 0, num_failed = 0;
+    bool halted = false;
+
+    for (;;) {
+        while (!halted && num_running < scheduler.max_jobs && scheduler.next_input < num_inputs) {
+            size_t count = take_batch();
+            spawn(&slots[num_running++], scheduler.next_input, count);
+            scheduler.next_input += count;
+        }
+        if (num_running == 0) {
+            break;
+        }
+
+        size_t i = wait_for_slot(slots, num_running);
+        int job_status = collect(&slots[i]);
+        slots[i] = slots[--num_running];
+
+        if (job_status != 0) {
+            num_failed++;
+            if (scheduler.halt != HALT_NEVER && !halted) {
+                halted = true;
+                for (size_t j = 0; scheduler.halt == HALT_NOW && j < num_running; j++) {
+                    job_kill(slots[j].job, SIGTERM);
+                }
+            }
+        }
+    }
+
+    free(slots);
+    status = num_failed > 101 ? 101 : num_failed;
+
+done:
+    ptr_array_destroy(scheduler.template, nothing);
+    ptr_array_destroy(scheduler.inputs, free);
+    return status;
+}
@@ -0,0 +1,11 @@
+#ifndef CODECRAFTERS_SHELL_PARALLEL_H_INCLUDED
+#define CODECRAFTERS_SHELL_PARALLEL_H_INCLUDED
+
+#include "ptr_array.h"
+
+// Runs a command once per batch of input arguments with a bounded number of concurrent jobs (the
+// parallel builtin). Inputs follow ":::" or are read one per line from standard input. Returns the
+// number of failed jobs, at most 101.
+int cmd_parallel(const PtrArray *arguments);
+
+#endif
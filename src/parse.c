@@ -2,25 +2,28 @@
 #include "cmd.h"
 #include "ptr_array.h"
 #include "redir.h"
+#include "str_buf.h"
 #include "token.h"
 #include "xmalloc.h"
 
-#include <assert.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#include <wordexp.h>
 
 static struct {
     const PtrArray *tokens;
     size_t current;
-    PtrArray *cmds;
+    PtrArray *pipelines;
+    bool had_error;
 } parser;
 
 static void init(const PtrArray *tokens) {
     parser.tokens = tokens;
     parser.current = 0;
-    parser.cmds = ptr_array_create();
+    parser.pipelines = ptr_array_create();
+    parser.had_error = false;
 }
 
 static const Token *peek(void) {
@@ -54,40 +57,168 @@ static bool match(TokenType type) {
     return true;
 }
 
+static void error_at(const Token *token) {
+    if (parser.had_error) {
+        return;
+    }
+    const char *lexeme = token->type == TOKEN_EOF || token->type == TOKEN_NEWLINE ? "newline"
+                                                                                 : token->lexeme;
+    fprintf(stderr, "syntax error near unexpected token `%s'\n", lexeme);
+    parser.had_error = true;
+}
+
+static bool is_command_end(void) {
+    return is_at_end() || check(TOKEN_OR) || check(TOKEN_AND) || check(TOKEN_AND_IF) ||
+           check(TOKEN_OR_IF) || check(TOKEN_SEMI) || check(TOKEN_NEWLINE);
+}
+
+static void redirection(PtrArray *redirs) {
+    int fd = -1;
+    if (match(TOKEN_IO_NUMBER)) {
+        fd = atoi(previous()->lexeme);
+    }
+
+    const Token *operator = advance();
+    RedirMode mode;
+    TokenType target = TOKEN_WORD;
+    switch (operator->type) {
+        case TOKEN_LESS:
+            mode = REDIR_INPUT;
+            break;
+        case TOKEN_LESSAND:
+            mode = REDIR_DUP_INPUT;
+            break;
+        case TOKEN_DLESS:
+        case TOKEN_DLESSDASH:
+            mode = check(TOKEN_HEREDOC_QUOTED) ? REDIR_HEREDOC_QUOTED : REDIR_HEREDOC;
+            target = check(TOKEN_HEREDOC_QUOTED) ? TOKEN_HEREDOC_QUOTED : TOKEN_HEREDOC;
+            break;
+        case TOKEN_TLESS:
+            mode = REDIR_HERESTRING;
+            break;
+        case TOKEN_GREAT:
+            mode = REDIR_OUTPUT;
+            break;
+        case TOKEN_DGREAT:
+            mode = REDIR_APPEND;
+            break;
+        case TOKEN_GREATAND:
+            mode = REDIR_DUP_OUTPUT;
+            break;
+        default:
+            error_at(operator);
+            return;
+    }
+    if (!match(target)) {
+        error_at(peek());
+        return;
+    }
+
+    if (fd < 0) {
+        bool is_output = mode == REDIR_OUTPUT || mode == REDIR_APPEND || mode == REDIR_DUP_OUTPUT;
+        fd = is_output ? STDOUT_FILENO : STDIN_FILENO;
+    }
+    ptr_array_append(redirs, redir_create(fd, previous()->lexeme, mode));
+}
+
 static Cmd *command(void) {
-    PtrArray *arguments = ptr_array_create();
     PtrArray *redirs = ptr_array_create();
 
-    while (!is_at_end() && !check(TOKEN_OR)) {
+    if (match(TOKEN_ARITH)) {
+        const char *lexeme = previous()->lexeme;
+        char *expression = xstrndup(lexeme + 2, strlen(lexeme) - 4);
+        while (!is_command_end() && !parser.had_error) {
+            redirection(redirs);
+        }
+        return cmd_create_arith(expression, redirs);
+    }
+
+    PtrArray *arguments = ptr_array_create();
+
+    while (!is_command_end() && !parser.had_error) {
         if (match(TOKEN_WORD)) {
-            static wordexp_t we;
-            wordexp(previous()->lexeme, &we, WRDE_REUSE);
-            for (size_t i = 0; i < we.we_wordc; i++) {
-                ptr_array_append(arguments, xstrdup(we.we_wordv[i]));
-            }
-            continue;
+            ptr_array_append(arguments, xstrdup(previous()->lexeme));
+        } else {
+            redirection(redirs);
         }
+    }
+    if (ptr_array_is_empty(arguments) && ptr_array_is_empty(redirs)) {
+        // An operator where a command should be, as in ";;" or a leading "|".
+        error_at(peek());
+    }
+
+    return cmd_create(arguments, redirs);
+}
 
-        int fd = STDOUT_FILENO;
-        if (match(TOKEN_IO_NUMBER)) {
-            fd = atoi(previous()->lexeme);
+// Joins the lexemes of the tokens in [start, end) to describe a pipeline.
+static char *join_lexemes(size_t start, size_t end) {
+    StrBuf *text = str_buf_create();
+    for (size_t i = start; i < end; i++) {
+        const Token *token = ptr_array_get_const(parser.tokens, i);
+        if (token->type == TOKEN_HEREDOC || token->type == TOKEN_HEREDOC_QUOTED) {
+            // Here-document bodies span lines, so they are left out of the description.
+            continue;
+        }
+        if (i > start) {
+            str_buf_append_char(text, ' ');
         }
-        assert(match(TOKEN_DGREAT) || match(TOKEN_GREAT));
-        RedirMode mode = previous()->type == TOKEN_DGREAT ? REDIR_APPEND : REDIR_NORMAL;
-        const char *path = advance()->lexeme;
+        str_buf_append(text, token->lexeme);
+    }
+    return str_buf_release(text);
+}
+
+static Pipeline *pipeline(PipelineCondition condition) {
+    size_t start = parser.current;
+    PtrArray *cmds = ptr_array_create();
+    do {
+        ptr_array_append(cmds, command());
+    } while (!parser.had_error && match(TOKEN_OR));
+
+    return pipeline_create(cmds, join_lexemes(start, parser.current), condition, false);
+}
 
-        ptr_array_append(redirs, redir_create(fd, path, mode));
+// Parses pipelines joined by && and ||, which may be followed by newlines, and the &, ; or newline
+// that ends them.
+static void and_or(void) {
+    size_t first = ptr_array_get_size(parser.pipelines);
+    PipelineCondition condition = PIPELINE_ALWAYS;
+    while (true) {
+        ptr_array_append(parser.pipelines, pipeline(condition));
+        if (parser.had_error) {
+            return;
+        } else if (match(TOKEN_AND_IF)) {
+            condition = PIPELINE_IF_SUCCESS;
+        } else if (match(TOKEN_OR_IF)) {
+            condition = PIPELINE_IF_FAILURE;
+        } else {
+            break;
+        }
+        while (match(TOKEN_NEWLINE)) {
+        }
     }
 
-    return cmd_create(arguments, redirs);
+    if (match(TOKEN_AND)) {
+        size_t num_pipelines = ptr_array_get_size(parser.pipelines);
+        for (size_t i = first; i < num_pipelines; i++) {
+            pipeline_set_background(ptr_array_get(parser.pipelines, i));
+        }
+    } else if (!match(TOKEN_SEMI)) {
+        match(TOKEN_NEWLINE);
+    }
 }
 
 PtrArray *parse(const PtrArray *tokens) {
     init(tokens);
-    if (!is_at_end()) {
-        do {
-            ptr_array_append(parser.cmds, command());
-        } while (match(TOKEN_OR));
+    while (!is_at_end() && !parser.had_error) {
+        if (match(TOKEN_NEWLINE)) {
+            continue;
+        }
+        and_or();
+    }
+
+    if (parser.had_error) {
+        ptr_array_destroy(parser.pipelines, pipeline_destroy);
+        return NULL;
     }
-    return parser.cmds;
+    return parser.pipelines;
 }
@@ -3,7 +3,8 @@
 
 #include "ptr_array.h"
 
-// Parses an array of tokens into an array of commands.
+// Parses an array of tokens into an array of pipelines. Returns NULL after reporting a syntax
+// error.
 PtrArray *parse(const PtrArray *tokens);
 
 #endif
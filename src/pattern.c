@@ -0,0 +1,317 @@
+#include "pattern.h"
+#include "xmalloc.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    SHAPE_LITERAL,
+    SHAPE_STAR_LITERAL,
+    SHAPE_LITERAL_STAR,
+    SHAPE_GENERAL,
+} Shape;
+
+// A pattern keeps its glob for the general matcher. Patterns of the common shapes lit, *lit and
+// lit* also keep the unquoted literal, which is searched for with the C library's vectorized
+// memchr(), memrchr() and memmem().
+struct Pattern {
+    char *glob;
+    Shape shape;
+    char *literal;
+    size_t literal_length;
+};
+
+static bool is_special(char c) {
+    return c == '*' || c == '?' || c == '[';
+}
+
+// Unquotes [start, end) into a literal. Returns NULL if it holds an unquoted special character.
+static char *literal_of(const char *start, const char *end, size_t *length) {
+    char *literal = xmalloc(end - start + 1);
+    size_t n = 0;
+    for (const char *p = start; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        } else if (is_special(*p)) {
+            free(literal);
+            return NULL;
+        }
+        literal[n++] = *p;
+    }
+    literal[n] = '\0';
+    *length = n;
+    return literal;
+}
+
+Pattern *pattern_create(const char *glob) {
+    Pattern *pattern = xmalloc(sizeof(Pattern));
+    pattern->glob = xstrdup(glob);
+
+    const char *start = glob, *end = glob + strlen(glob);
+    pattern->shape = SHAPE_LITERAL;
+    if (*start == '*') {
+        pattern->shape = SHAPE_STAR_LITERAL;
+        start++;
+    } else if (end > start && end[-1] == '*' && (end - start < 2 || end[-2] != '\\')) {
+        pattern->shape = SHAPE_LITERAL_STAR;
+        end--;
+    }
+    pattern->literal = literal_of(start, end, &pattern->literal_length);
+    if (pattern->literal == NULL) {
+        pattern->shape = SHAPE_GENERAL;
+    }
+    return pattern;
+}
+
+void pattern_destroy(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    Pattern *pattern = ptr;
+    free(pattern->glob);
+    free(pattern->literal);
+    free(pattern);
+}
+
+bool pattern_is_empty(const Pattern *pattern) {
+    return pattern->glob[0] == '\0';
+}
+
+// Matches a character against a bracket expression starting after its '['. Returns a pointer past
+// the expression, or NULL if it is not closed, in which case the '[' is an ordinary character.
+static const char *match_bracket(const char *p, char c, bool *matched) {
+    bool negated = *p == '!' || *p == '^';
+    if (negated) {
+        p++;
+    }
+
+    *matched = false;
+    bool first = true;
+    for (; *p != '\0' && (*p != ']' || first); first = false) {
+        if (p[0] == '[' && p[1] == ':') {
+            const char *close = strstr(p + 2, ":]");
+            if (close != NULL) {
+                static const struct {
+                    const char *name;
+                    int (*is)(int);
+                } classes[] = {{"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+                               {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+                               {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+                               {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit}};
+                size_t length = close - p - 2;
+                for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+                    if (strlen(classes[i].name) == length &&
+                        strncmp(p + 2, classes[i].name, length) == 0 &&
+                        classes[i].is((unsigned char)c)) {
+                        *matched = true;
+                    }
+                }
+                p = close + 2;
+                continue;
+            }
+        }
+
+        char low = *p == '\\' && p[1] != '\0' ? *++p : *p;
+        p++;
+        char high = low;
+        if (p[0] == '-' && p[1] != ']' && p[1] != '\0') {
+            high = p[1] == '\\' && p[2] != '\0' ? p[2] : p[1];
+            p += p[1] == '\\' && p[2] != '\0' ? 3 : 2;
+        }
+        if ((unsigned char)low <= (unsigned char)c && (unsigned char)c <= (unsigned char)high) {
+            *matched = true;
+        }
+    }
+    if (*p != ']') {
+        return NULL;
+    }
+    if (negated) {
+        *matched = !*matched;
+    }
+    return p + 1;
+}
+
+// Matches one character against the pattern element at p, other than a '*'. Returns a pointer past
+// the element, or NULL if the character does not match.
+static const char *match_one(const char *p, char c) {
+    switch (*p) {
+        case '\0':
+            return NULL;
+        case '?':
+            return p + 1;
+        case '[': {
+            bool matched;
+            const char *end = match_bracket(p + 1, c, &matched);
+            if (end != NULL) {
+                return matched ? end : NULL;
+            }
+            return c == '[' ? p + 1 : NULL;
+        }
+        case '\\':
+            if (p[1] != '\0') {
+                return p[1] == c ? p + 2 : NULL;
+            }
+            return c == '\\' ? p + 1 : NULL;
+        default:
+            return *p == c ? p + 1 : NULL;
+    }
+}
+
+// Matches a whole string against a glob. On a mismatch after a '*', the star takes one more
+// character and matching resumes there, which bounds the work by the product of the lengths.
+static bool match_glob(const char *p, const char *s, size_t length) {
+    const char *star = NULL;
+    size_t star_index = 0, i = 0;
+    while (i < length) {
+        if (*p == '*') {
+            star = ++p;
+            star_index = i;
+            continue;
+        }
+        const char *next = match_one(p, s[i]);
+        if (next != NULL) {
+            p = next;
+            i++;
+        } else if (star != NULL) {
+            p = star;
+            i = ++star_index;
+        } else {
+            return false;
+        }
+    }
+    while (*p == '*') {
+        p++;
+    }
+    return *p == '\0';
+}
+
+static const char *find_first(const char *s, size_t length, const char *literal, size_t n) {
+    return memmem(s, length, literal, n);
+}
+
+static const char *find_last(const char *s, size_t length, const char *literal, size_t n) {
+    if (n == 0) {
+        return s + length;
+    }
+    while (length >= n) {
+        const char *p = memrchr(s, literal[0], length - n + 1);
+        if (p == NULL) {
+            return NULL;
+        }
+        if (memcmp(p, literal, n) == 0) {
+            return p;
+        }
+        length = p - s + n - 1;
+    }
+    return NULL;
+}
+
+static bool has_prefix(const Pattern *pattern, const char *s, size_t length) {
+    return length >= pattern->literal_length &&
+           memcmp(s, pattern->literal, pattern->literal_length) == 0;
+}
+
+static bool has_suffix(const Pattern *pattern, const char *s, size_t length) {
+    size_t n = pattern->literal_length;
+    return length >= n && memcmp(s + length - n, pattern->literal, n) == 0;
+}
+
+ssize_t pattern_match_prefix(const Pattern *pattern, const char *s, size_t length, bool longest) {
+    const char *found;
+    switch (pattern->shape) {
+        case SHAPE_LITERAL:
+            return has_prefix(pattern, s, length) ? (ssize_t)pattern->literal_length : -1;
+        case SHAPE_LITERAL_STAR:
+            if (!has_prefix(pattern, s, length)) {
+                return -1;
+            }
+            return longest ? (ssize_t)length : (ssize_t)pattern->literal_length;
+        case SHAPE_STAR_LITERAL:
+            found = longest ? find_last(s, length, pattern->literal, pattern->literal_length)
+                            : find_first(s, length, pattern->literal, pattern->literal_length);
+            return found != NULL ? found - s + (ssize_t)pattern->literal_length : -1;
+        case SHAPE_GENERAL:
+            break;
+    }
+
+    for (size_t i = 0; i <= length; i++) {
+        size_t n = longest ? length - i : i;
+        if (match_glob(pattern->glob, s, n)) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+ssize_t pattern_match_suffix(const Pattern *pattern, const char *s, size_t length, bool longest) {
+    const char *found;
+    switch (pattern->shape) {
+        case SHAPE_LITERAL:
+            return has_suffix(pattern, s, length) ? (ssize_t)(length - pattern->literal_length)
+                                                  : -1;
+        case SHAPE_STAR_LITERAL:
+            if (!has_suffix(pattern, s, length)) {
+                return -1;
+            }
+            return longest ? 0 : (ssize_t)(length - pattern->literal_length);
+        case SHAPE_LITERAL_STAR:
+            found = longest ? find_first(s, length, pattern->literal, pattern->literal_length)
+                            : find_last(s, length, pattern->literal, pattern->literal_length);
+            return found != NULL ? found - s : -1;
+        case SHAPE_GENERAL:
+            break;
+    }
+
+    for (size_t i = 0; i <= length; i++) {
+        size_t start = longest ? i : length - i;
+        if (match_glob(pattern->glob, s + start, length - start)) {
+            return start;
+        }
+    }
+    return -1;
+}
+
+bool pattern_find(const Pattern *pattern, const char *s, size_t length, size_t *start,
+                  size_t *match_length) {
+    const char *found;
+    switch (pattern->shape) {
+        case SHAPE_LITERAL:
+            found = find_first(s, length, pattern->literal, pattern->literal_length);
+            if (found == NULL) {
+                return false;
+            }
+            *start = found - s;
+            *match_length = pattern->literal_length;
+            return true;
+        case SHAPE_LITERAL_STAR:
+            found = find_first(s, length, pattern->literal, pattern->literal_length);
+            if (found == NULL) {
+                return false;
+            }
+            *start = found - s;
+            *match_length = length - *start;
+            return true;
+        case SHAPE_STAR_LITERAL: {
+            ssize_t end = pattern_match_prefix(pattern, s, length, true);
+            if (end < 0) {
+                return false;
+            }
+            *start = 0;
+            *match_length = end;
+            return true;
+        }
+        case SHAPE_GENERAL:
+            break;
+    }
+
+    for (size_t i = 0; i <= length; i++) {
+        ssize_t n = pattern_match_prefix(pattern, s + i, length - i, true);
+        if (n >= 0) {
+            *start = i;
+            *match_length = n;
+            return true;
+        }
+    }
+    return false;
+}
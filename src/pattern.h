@@ -0,0 +1,34 @@
+#ifndef CODECRAFTERS_SHELL_PATTERN_H_INCLUDED
+#define CODECRAFTERS_SHELL_PATTERN_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct Pattern Pattern;
+
+// Compiles a glob pattern, in which * matches any string, ? any character, [...] a bracket
+// expression, and a backslash quotes the next character. Patterns that are a literal string,
+// optionally preceded or followed by a *, are matched with memcmp() and memmem() instead.
+Pattern *pattern_create(const char *glob);
+
+// Deallocates memory for a pattern.
+void pattern_destroy(void *pattern);
+
+// Checks whether a pattern is empty.
+bool pattern_is_empty(const Pattern *pattern);
+
+// Finds the shortest or longest prefix of a string that matches a pattern. Returns its length, or
+// -1 if there is none.
+ssize_t pattern_match_prefix(const Pattern *pattern, const char *s, size_t length, bool longest);
+
+// Finds the shortest or longest suffix of a string that matches a pattern. Returns the index where
+// it starts, or -1 if there is none.
+ssize_t pattern_match_suffix(const Pattern *pattern, const char *s, size_t length, bool longest);
+
+// Finds the leftmost substring that matches a pattern, taking the longest one at that position.
+// Returns false if there is none.
+bool pattern_find(const Pattern *pattern, const char *s, size_t length, size_t *start,
+                  size_t *match_length);
+
+#endif
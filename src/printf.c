@@ -0,0 +1,268 @@
+#include "printf.h"
+#include "ptr_array.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct {
+    const PtrArray *arguments;
+    size_t current;
+    bool consumed;
+    bool stop;
+    int status;
+} formatter;
+
+static const char *next_arg(void) {
+    if (formatter.current >= ptr_array_get_size(formatter.arguments)) {
+        return NULL;
+    }
+    formatter.consumed = true;
+    return ptr_array_get_const(formatter.arguments, formatter.current++);
+}
+
+static void conversion_error(const char *arg, const char *message) {
+    fprintf(stderr, "printf: %s: %s\n", arg, message);
+    formatter.status = 1;
+}
+
+static long long integer_arg(void) {
+    const char *arg = next_arg();
+    if (arg == NULL) {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '\"') {
+        return (unsigned char)arg[1];
+    }
+
+    errno = 0;
+    char *end;
+    long long value = strtoll(arg, &end, 0);
+    if (errno == ERANGE && value == LLONG_MAX) {
+        // Let unsigned conversions print values between LLONG_MAX and ULLONG_MAX.
+        errno = 0;
+        value = (long long)strtoull(arg, &end, 0);
+    }
+    if (end == arg || *end != '\0') {
+        conversion_error(arg, end == arg ? "invalid number" : "not completely converted");
+    } else if (errno == ERANGE) {
+        conversion_error(arg, strerror(errno));
+    }
+    return value;
+}
+
+static double floating_arg(void) {
+    const char *arg = next_arg();
+    if (arg == NULL) {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '\"') {
+        return (unsigned char)arg[1];
+    }
+
+    char *end;
+    double value = strtod(arg, &end);
+    if (end == arg || *end != '\0') {
+        conversion_error(arg, end == arg ? "invalid number" : "not completely converted");
+    }
+    return value;
+}
+
+// Writes the character denoted by the escape sequence following a backslash. In %b arguments,
+// octal escapes take a leading zero and \c stops all further output. Returns a pointer past the
+// escape sequence.
+static const char *escape(const char *p, bool in_b, FILE *out) {
+    static const char *simple = "\\\\a\ab\bf\fn\nr\rt\tv\v\"\"\'\'";
+    for (const char *s = simple; *s != '\0'; s += 2) {
+        if (*p == s[0]) {
+            fputc(s[1], out);
+            return p + 1;
+        }
+    }
+
+    if (*p == 'c' && in_b) {
+        formatter.stop = true;
+        return p + strlen(p);
+    }
+
+    int max_digits = 3, base = 8, value = 0, n = 0;
+    if (*p == 'x') {
+        max_digits = 2;
+        base = 16;
+        p++;
+    } else if (*p == '0' && in_b) {
+        p++;
+    } else if (*p < '0' || *p > '7') {
+        fputc('\\', out);
+        return p;
+    }
+
+    for (; n < max_digits && *p != '\0'; n++, p++) {
+        int digit;
+        if (*p >= '0' && *p <= '7') {
+            digit = *p - '0';
+        } else if (base == 16 && isxdigit((unsigned char)*p)) {
+            digit = isdigit((unsigned char)*p) ? *p - '0' : tolower((unsigned char)*p) - 'a' + 10;
+        } else {
+            break;
+        }
+        value = value * base + digit;
+    }
+
+    if (base == 16 && n == 0) {
+        fputs("\\x", out);
+    } else {
+        fputc(value, out);
+    }
+    return p;
+}
+
+// Appends a field width or precision taken from the next argument to a conversion spec.
+static void append_star(char *spec, size_t size) {
+    size_t length = strlen(spec);
+    snprintf(spec + length, size - length, "%lld", integer_arg());
+}
+
+// Handles one conversion specification. Returns a pointer past it.
+static const char *convert(const char *p) {
+    char spec[64] = "%";
+    size_t length = 1;
+
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL && length < 8) {
+        spec[length++] = *p++;
+    }
+    if (*p == '*') {
+        append_star(spec, sizeof(spec) - 8);
+        p++;
+    } else {
+        while (isdigit((unsigned char)*p) && length < 24) {
+            spec[length++] = *p++;
+        }
+    }
+    if (*p == '.') {
+        length = strlen(spec);
+        spec[length++] = *p++;
+        if (*p == '*') {
+            append_star(spec, sizeof(spec) - 8);
+            p++;
+        } else {
+            while (isdigit((unsigned char)*p) && length < 48) {
+                spec[length++] = *p++;
+            }
+        }
+    }
+    length = strlen(spec);
+
+    char c = *p++;
+    switch (c) {
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            spec[length++] = 'l';
+            spec[length++] = 'l';
+            spec[length++] = c;
+            spec[length] = '\0';
+            printf(spec, integer_arg());
+            break;
+        case 'a':
+        case 'A':
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+            spec[length++] = c;
+            spec[length] = '\0';
+            printf(spec, floating_arg());
+            break;
+        case 'c': {
+            const char *arg = next_arg();
+            spec[length++] = 'c';
+            spec[length] = '\0';
+            if (arg != NULL && arg[0] != '\0') {
+                printf(spec, arg[0]);
+            } else {
+                spec[length - 1] = 's';
+                printf(spec, "");
+            }
+            break;
+        }
+        case 's': {
+            const char *arg = next_arg();
+            spec[length++] = 's';
+            spec[length] = '\0';
+            printf(spec, arg != NULL ? arg : "");
+            break;
+        }
+        case 'b': {
+            const char *arg = next_arg();
+            char *expanded = NULL;
+            size_t expanded_size = 0;
+            FILE *out = open_memstream(&expanded, &expanded_size);
+            for (const char *q = arg != NULL ? arg : ""; *q != '\0';) {
+                if (*q == '\\') {
+                    q = escape(q + 1, true, out);
+                } else {
+                    fputc(*q++, out);
+                }
+            }
+            fclose(out);
+            spec[length++] = 's';
+            spec[length] = '\0';
+            printf(spec, expanded);
+            free(expanded);
+            break;
+        }
+        case '%':
+            putchar('%');
+            break;
+        default:
+            fprintf(stderr, "printf: %%%c: invalid format character\n", c);
+            formatter.status = 1;
+            formatter.stop = true;
+            return c == '\0' ? p - 1 : p;
+    }
+    return p;
+}
+
+static void format_once(const char *format) {
+    const char *p = format;
+    while (*p != '\0' && !formatter.stop) {
+        if (*p == '\\') {
+            p = escape(p + 1, false, stdout);
+        } else if (*p == '%') {
+            p = convert(p + 1);
+        } else {
+            putchar(*p++);
+        }
+    }
+}
+
+int cmd_printf(const PtrArray *arguments) {
+    size_t num_args = ptr_array_get_size(arguments);
+    if (num_args < 2) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    formatter.arguments = arguments;
+    formatter.current = 2;
+    formatter.stop = false;
+    formatter.status = 0;
+
+    const char *format = ptr_array_get_const(arguments, 1);
+    do {
+        formatter.consumed = false;
+        format_once(format);
+    } while (!formatter.stop && formatter.consumed && formatter.current < num_args);
+
+    return formatter.status;
+}
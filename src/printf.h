@@ -0,0 +1,10 @@
+#ifndef CODECRAFTERS_SHELL_PRINTF_H_INCLUDED
+#define CODECRAFTERS_SHELL_PRINTF_H_INCLUDED
+
+#include "ptr_array.h"
+
+// Writes formatted output (the printf builtin). The format is reused until all arguments are
+// consumed. Returns 0 on success, or 1 if an argument could not be converted.
+int cmd_printf(const PtrArray *arguments);
+
+#endif
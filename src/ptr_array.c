@@ -20,7 +20,7 @@ PtrArray *ptr_array_create(void) {
 }
 
 void ptr_array_destroy(PtrArray *array, void (*ptr_destroy)(void *)) {
-    for (size_t i = 0; i < array->size; i++) {
+    for (size_t i = 0; ptr_destroy != NULL && i < array->size; i++) {
         ptr_destroy(array->ptrs[i]);
     }
     free(array->ptrs);
@@ -45,6 +45,11 @@ void *ptr_array_get(PtrArray *array, size_t index) {
     return array->ptrs[index];
 }
 
+void ptr_array_set(PtrArray *array, size_t index, void *ptr) {
+    assert(index < array->size);
+    array->ptrs[index] = ptr;
+}
+
 void ptr_array_append(PtrArray *array, void *ptr) {
     if (array->size == array->capacity) {
         array->capacity *= 2;
@@ -53,6 +58,11 @@ void ptr_array_append(PtrArray *array, void *ptr) {
     array->ptrs[array->size++] = ptr;
 }
 
+void *ptr_array_pop(PtrArray *array) {
+    assert(array->size > 0);
+    return array->ptrs[--array->size];
+}
+
 void **ptr_array_get_c_array(PtrArray *array) {
     return array->ptrs;
 }
@@ -9,7 +9,8 @@ typedef struct PtrArray PtrArray;
 // Allocates memory for an empty array of pointers.
 PtrArray *ptr_array_create(void);
 
-// Deallocates memory for an array of pointers, and the objects pointed to by the pointers.
+// Deallocates memory for an array of pointers, and the objects pointed to by the pointers unless
+// ptr_destroy is NULL.
 void ptr_array_destroy(PtrArray *array, void (*ptr_destroy)(void *));
 
 // Checks whether an array of pointers is empty.
@@ -24,9 +25,15 @@ const void *ptr_array_get_const(const PtrArray *array, size_t index);
 // Gets the pointer at a specific location in an array.
 void *ptr_array_get(PtrArray *array, size_t index);
 
+// Replaces the pointer at a specific location in an array.
+void ptr_array_set(PtrArray *array, size_t index, void *ptr);
+
 // Appends a pointer to the end of an array.
 void ptr_array_append(PtrArray *array, void *ptr);
 
+// Removes and returns the pointer at the end of an array.
+void *ptr_array_pop(PtrArray *array);
+
 // Returns the underlying C array of pointers.
 void **ptr_array_get_c_array(PtrArray *array);
 
@@ -0,0 +1,414 @@
+#include "read.h"
+#include "misc.h"
+#include "ptr_array.h"
+#include "var.h"
+#include "xmalloc.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum {
+    MIN_BLOCK_SIZE = 4096,
+    MAX_BLOCK_SIZE = 1 << 20,
+};
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    char *data;
+    size_t start;
+    size_t end;
+    size_t capacity;
+} Buffer;
+
+// Input is read in blocks that double in size up to MAX_BLOCK_SIZE, and lines are found in them
+// with memchr(). What is read past the last line has to be given back for the next reader: a
+// regular file seeks back over it, while a pipe or socket, which cannot, keeps it in a buffer
+// shared by all reads from the same file descriptor. Other input, and the shell's own input when it
+// is not a terminal in canonical mode, is read one byte at a time so that nothing is read past the
+// line.
+typedef struct {
+    int fd;
+    Buffer *buffer;
+    Buffer local;
+    bool seekable;
+    size_t block_size;
+    int error;
+} Reader;
+
+// The buffers shared by reads from pipes and sockets, indexed by file descriptor. A buffer is
+// emptied once its file descriptor refers to another file.
+static struct {
+    Buffer *buffers;
+    size_t num_buffers;
+    struct stat shell_input;
+    bool has_shell_input;
+} input;
+
+void read_init(void) {
+    input.has_shell_input = fstat(STDIN_FILENO, &input.shell_input) == 0;
+}
+
+static bool is_shell_input(const struct stat *st) {
+    return input.has_shell_input && st->st_dev == input.shell_input.st_dev &&
+           st->st_ino == input.shell_input.st_ino;
+}
+
+static Buffer *shared_buffer(int fd, const struct stat *st) {
+    if ((size_t)fd >= input.num_buffers) {
+        size_t num_buffers = fd + 1;
+        input.buffers = xrealloc(input.buffers, sizeof(Buffer) * num_buffers);
+        memset(input.buffers + input.num_buffers, 0,
+               sizeof(Buffer) * (num_buffers - input.num_buffers));
+        input.num_buffers = num_buffers;
+    }
+
+    Buffer *buffer = &input.buffers[fd];
+    if (buffer->dev != st->st_dev || buffer->ino != st->st_ino) {
+        buffer->dev = st->st_dev;
+        buffer->ino = st->st_ino;
+        buffer->start = buffer->end = 0;
+    }
+    return buffer;
+}
+
+static bool reader_open(Reader *reader, int fd, char delimiter, const char *builtin) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %d: %s\n", builtin, fd, strerror(errno));
+        return false;
+    }
+
+    reader->fd = fd;
+    reader->buffer = &reader->local;
+    reader->local = (Buffer){0};
+    reader->seekable = S_ISREG(st.st_mode);
+    reader->block_size = MIN_BLOCK_SIZE;
+    reader->error = 0;
+    if ((S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)) && !is_shell_input(&st)) {
+        reader->buffer = shared_buffer(fd, &st);
+    } else if (!reader->seekable && !(isatty(fd) && delimiter == '\n')) {
+        // A terminal in canonical mode returns at most one line per read.
+        reader->block_size = 1;
+    }
+    return true;
+}
+
+// Gives back what was read past the last line to a regular file.
+static void reader_close(Reader *reader) {
+    const Buffer *buffer = reader->buffer;
+    if (reader->seekable && buffer->end > buffer->start) {
+        lseek(reader->fd, -(off_t)(buffer->end - buffer->start), SEEK_CUR);
+    }
+    free(reader->local.data);
+}
+
+// Reads another block into the buffer, first moving the unread input to its start. Returns the
+// number of bytes read, 0 at the end of the input, or -1 on an error.
+static ssize_t fill(Reader *reader) {
+    Buffer *buffer = reader->buffer;
+    if (buffer->start > 0) {
+        memmove(buffer->data, buffer->data + buffer->start, buffer->end - buffer->start);
+        buffer->end -= buffer->start;
+        buffer->start = 0;
+    }
+    if (buffer->end + reader->block_size > buffer->capacity) {
+        buffer->capacity = buffer->end + reader->block_size;
+        buffer->data = xrealloc(buffer->data, buffer->capacity);
+    }
+
+    ssize_t n;
+    do {
+        n = read(reader->fd, buffer->data + buffer->end, reader->block_size);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        reader->error = errno;
+    } else {
+        buffer->end += n;
+    }
+    if (n > 0 && reader->block_size > 1 && reader->block_size < MAX_BLOCK_SIZE) {
+        reader->block_size *= 2;
+    }
+    return n;
+}
+
+// Finds the next line, reading more input as needed. The line is left in the buffer, without its
+// delimiter, until the next call. Sets *delimited unless the input ended before a delimiter.
+// Returns false at the end of the input.
+static bool next_line(Reader *reader, char delimiter, const char **line, size_t *length,
+                      bool *delimited) {
+    Buffer *buffer = reader->buffer;
+    size_t scanned = 0;
+    for (;;) {
+        size_t unscanned = buffer->end - buffer->start - scanned;
+        const char *found =
+            unscanned > 0 ? memchr(buffer->data + buffer->start + scanned, delimiter, unscanned)
+                          : NULL;
+        if (found != NULL) {
+            *line = buffer->data + buffer->start;
+            *length = found - *line;
+            *delimited = true;
+            buffer->start = found - buffer->data + 1;
+            return true;
+        }
+
+        scanned += unscanned;
+        if (fill(reader) <= 0) {
+            break;
+        }
+    }
+
+    if (buffer->end == buffer->start) {
+        return false;
+    }
+    *line = buffer->data + buffer->start;
+    *length = buffer->end - buffer->start;
+    *delimited = false;
+    buffer->start = buffer->end;
+    return true;
+}
+
+// Parses the argument of an option of read or mapfile that takes a file descriptor.
+static bool parse_fd(const char *arg, int *fd, const char *builtin) {
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < 0 || value > 1024 * 1024) {
+        fprintf(stderr, "%s: %s: invalid file descriptor specification\n", builtin, arg);
+        return false;
+    }
+    *fd = (int)value;
+    return true;
+}
+
+static bool is_ifs_char(char c, const char *ifs) {
+    return c != '\0' && strchr(ifs, c) != NULL;
+}
+
+static bool is_ifs_space(char c, const char *ifs) {
+    return (c == ' ' || c == '\t' || c == '\n') && is_ifs_char(c, ifs);
+}
+
+// Assigns the fields of a line to variables, the last of which gets the rest of the line. Escaped
+// characters never split fields.
+static int split_into_vars(const PtrArray *arguments, size_t first_name, const char *line,
+                           const bool *escaped, size_t length) {
+    size_t num_args = ptr_array_get_size(arguments);
+    int status = 0;
+
+    // Assigning the variables below may change IFS itself.
+    const char *ifs_value = var_get("IFS");
+    char *ifs = xstrdup(ifs_value != NULL ? ifs_value : " \t\n");
+
+    size_t i = 0;
+    while (i < length && !escaped[i] && is_ifs_space(line[i], ifs)) {
+        i++;
+    }
+
+    for (size_t n = first_name; n < num_args || n == first_name; n++) {
+        const char *name = n < num_args ? ptr_array_get_const(arguments, n) : "REPLY";
+        size_t start = i, end;
+
+        if (n + 1 < num_args) {
+            while (i < length && (escaped[i] || !is_ifs_char(line[i], ifs))) {
+                i++;
+            }
+            end = i;
+            while (i < length && !escaped[i] && is_ifs_space(line[i], ifs)) {
+                i++;
+            }
+            if (i < length && !escaped[i] && is_ifs_char(line[i], ifs)) {
+                i++;
+                while (i < length && !escaped[i] && is_ifs_space(line[i], ifs)) {
+                    i++;
+                }
+            }
+        } else {
+            end = length;
+            while (end > start && !escaped[end - 1] && is_ifs_space(line[end - 1], ifs)) {
+                end--;
+            }
+            i = length;
+        }
+
+        if (!is_valid_name(name)) {
+            fprintf(stderr, "read: `%s': not a valid identifier\n", name);
+            status = 2;
+            continue;
+        }
+        char *value = xstrndup(line + start, end - start);
+        if (!var_set(name, value)) {
+            status = 1;
+        }
+        free(value);
+    }
+
+    free(ifs);
+    return status;
+}
+
+int cmd_read(const PtrArray *arguments) {
+    size_t num_args = ptr_array_get_size(arguments);
+    bool raw = false;
+    char delimiter = '\n';
+    int fd = STDIN_FILENO;
+    size_t first_name = 1;
+    for (; first_name < num_args; first_name++) {
+        const char *option = ptr_array_get_const(arguments, first_name);
+        if (strcmp(option, "-r") == 0) {
+            raw = true;
+        } else if ((strcmp(option, "-d") == 0 || strcmp(option, "-u") == 0) &&
+                   first_name + 1 < num_args) {
+            const char *arg = ptr_array_get_const(arguments, ++first_name);
+            if (option[1] == 'd') {
+                delimiter = *arg;
+            } else if (!parse_fd(arg, &fd, "read")) {
+                return 2;
+            }
+        } else if (strcmp(option, "--") == 0) {
+            first_name++;
+            break;
+        } else {
+            break;
+        }
+    }
+
+    Reader reader;
+    if (!reader_open(&reader, fd, delimiter, "read")) {
+        return 1;
+    }
+
+    size_t length = 0, capacity = 0;
+    char *line = NULL;
+    bool *escaped = NULL;
+    int status = 0;
+    const char *segment;
+    size_t segment_length;
+    bool delimited;
+    while (next_line(&reader, delimiter, &segment, &segment_length, &delimited)) {
+        if (length + segment_length + 1 > capacity) {
+            capacity = (length + segment_length + 1) * 2;
+            line = xrealloc(line, capacity);
+            escaped = xrealloc(escaped, capacity);
+        }
+
+        // Without -r, a backslash escapes the next character, and one at the end of a line joins
+        // the next line to it.
+        bool continued = false;
+        for (size_t i = 0; i < segment_length; i++) {
+            bool is_escaped = !raw && segment[i] == '\\';
+            if (is_escaped && ++i == segment_length) {
+                continued = true;
+                break;
+            }
+            line[length] = segment[i];
+            escaped[length++] = is_escaped;
+        }
+        if (!delimited) {
+            status = 1;
+        }
+        if (!continued || !delimited) {
+            break;
+        }
+    }
+    if (line == NULL) {
+        status = 1;
+        line = xstrdup("");
+        escaped = xmalloc(1);
+    }
+    line[length] = '\0';
+    if (reader.error != 0) {
+        fprintf(stderr, "read: %s\n", strerror(reader.error));
+        status = 1;
+    }
+    reader_close(&reader);
+
+    int split_status = split_into_vars(arguments, first_name, line, escaped, length);
+    free(line);
+    free(escaped);
+    return split_status != 0 ? split_status : status;
+}
+
+int cmd_mapfile(const PtrArray *arguments) {
+    const char *builtin = ptr_array_get_const(arguments, 0);
+    size_t num_args = ptr_array_get_size(arguments);
+    char delimiter = '\n';
+    bool strip = false;
+    int fd = STDIN_FILENO;
+    size_t max_lines = SIZE_MAX, skip = 0;
+    size_t i = 1;
+    for (; i < num_args; i++) {
+        const char *option = ptr_array_get_const(arguments, i);
+        if (strcmp(option, "-t") == 0) {
+            strip = true;
+        } else if (option[0] == '-' && option[1] != '\0' && strchr("dnsu", option[1]) != NULL &&
+                   option[2] == '\0' && i + 1 < num_args) {
+            const char *arg = ptr_array_get_const(arguments, ++i);
+            char *end;
+            if (option[1] == 'd') {
+                delimiter = *arg;
+            } else if (option[1] == 'u') {
+                if (!parse_fd(arg, &fd, builtin)) {
+                    return 1;
+                }
+            } else {
+                unsigned long count = strtoul(arg, &end, 10);
+                if (*arg == '\0' || *end != '\0') {
+                    fprintf(stderr, "%s: %s: invalid line count\n", builtin, arg);
+                    return 1;
+                }
+                *(option[1] == 'n' ? &max_lines : &skip) = count;
+            }
+        } else if (strcmp(option, "--") == 0) {
+            i++;
+            break;
+        } else if (option[0] == '-' && option[1] != '\0') {
+            fprintf(stderr, "%s: %s: invalid option\n", builtin, option);
+            fprintf(stderr, "%s: usage: %s [-d delim] [-n count] [-s count] [-t] [-u fd] [array]\n",
+                    builtin, builtin);
+            return 2;
+        } else {
+            break;
+        }
+    }
+    if (max_lines == 0) {
+        max_lines = SIZE_MAX;
+    }
+
+    const char *name = i < num_args ? ptr_array_get_const(arguments, i) : "MAPFILE";
+    if (!is_valid_name(name)) {
+        fprintf(stderr, "%s: `%s': not a valid identifier\n", builtin, name);
+        return 1;
+    }
+
+    Reader reader;
+    if (!reader_open(&reader, fd, delimiter, builtin)) {
+        return 1;
+    }
+
+    PtrArray *elements = ptr_array_create();
+    const char *line;
+    size_t length, num_lines = 0;
+    bool delimited;
+    while (ptr_array_get_size(elements) < max_lines &&
+           next_line(&reader, delimiter, &line, &length, &delimited)) {
+        if (num_lines++ >= skip) {
+            ptr_array_append(elements, xstrndup(line, length + (delimited && !strip)));
+        }
+    }
+
+    int status = 0;
+    if (reader.error != 0) {
+        fprintf(stderr, "%s: %s\n", builtin, strerror(reader.error));
+        status = 1;
+    }
+    reader_close(&reader);
+    if (!var_set_array(name, elements)) {
+        status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,16 @@
+#ifndef CODECRAFTERS_SHELL_READ_H_INCLUDED
+#define CODECRAFTERS_SHELL_READ_H_INCLUDED
+
+#include "ptr_array.h"
+
+// Records the file that the shell reads its commands from, which read and mapfile never read ahead
+// from.
+void read_init(void);
+
+// Reads a line and splits it into variables at IFS characters (the read builtin).
+int cmd_read(const PtrArray *arguments);
+
+// Reads lines into an array (the mapfile and readarray builtins).
+int cmd_mapfile(const PtrArray *arguments);
+
+#endif
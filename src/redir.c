@@ -1,20 +1,32 @@
 #include "redir.h"
+#include "expand.h"
+#include "serial.h"
 #include "xmalloc.h"
 
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+// Saved file descriptors are moved out of the range that commands are likely to redirect.
+#define SAVED_FD_MIN 10
+
 struct Redir {
     int fd, saved_fd;
-    char *path;
+    char *word;
     RedirMode mode;
 };
 
-Redir *redir_create(int fd, const char *path, RedirMode mode) {
+Redir *redir_create(int fd, const char *word, RedirMode mode) {
     Redir *redir = xmalloc(sizeof(Redir));
     redir->fd = fd;
-    redir->path = xstrdup(path);
+    redir->saved_fd = -1;
+    redir->word = xstrdup(word);
     redir->mode = mode;
     return redir;
 }
@@ -24,20 +36,197 @@ void redir_destroy(void *ptr) {
         return;
     }
     Redir *redir = ptr;
-    free(redir->path);
+    free(redir->word);
     free(redir);
 }
 
-void redir_do(Redir *redir) {
-    int open_flags = O_WRONLY | O_CREAT | (redir->mode == REDIR_APPEND ? O_APPEND : O_TRUNC);
-    int file_fd = open(redir->path, open_flags, 0644);
-    redir->saved_fd = dup(redir->fd);
-    dup2(file_fd, redir->fd);
-    close(file_fd);
+void redir_write(const Redir *redir, FILE *stream) {
+    serial_write_u64(stream, (uint64_t)redir->fd);
+    serial_write_u64(stream, redir->mode);
+    serial_write_string(stream, redir->word);
+}
+
+Redir *redir_read(FILE *stream) {
+    uint64_t fd, mode;
+    if (!serial_read_u64(stream, &fd) || !serial_read_u64(stream, &mode) || fd > INT_MAX ||
+        mode > REDIR_HERESTRING) {
+        return NULL;
+    }
+    char *word = serial_read_string(stream);
+    if (word == NULL) {
+        return NULL;
+    }
+    Redir *redir = redir_create((int)fd, word, (RedirMode)mode);
+    free(word);
+    return redir;
+}
+
+static bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Returns a file descriptor to read the contents of a here-document or here-string from. A payload
+// that fits in a pipe is written to one, which never blocks because the pipe holds at least
+// PIPE_BUF bytes; larger ones go to an anonymous memory-backed file. Neither touches the
+// filesystem.
+static int open_heredoc(const char *contents) {
+    size_t size = strlen(contents);
+    int fds[2];
+    if (size <= PIPE_BUF && pipe2(fds, O_CLOEXEC) == 0) {
+        write_all(fds[1], contents, size);
+        close(fds[1]);
+        return fds[0];
+    }
+
+    int fd = memfd_create("heredoc", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (!write_all(fd, contents, size) || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Parses the target of a duplication. Returns the file descriptor, -1 to close, or -2 if the word
+// is not a file descriptor.
+static int parse_dup_target(const char *word) {
+    if (strcmp(word, "-") == 0) {
+        return -1;
+    }
+    if (*word == '\0' || strlen(word) > 9) {
+        return -2;
+    }
+    for (const char *p = word; *p != '\0'; p++) {
+        if (!isdigit((unsigned char)*p)) {
+            return -2;
+        }
+    }
+    return atoi(word);
+}
+
+// Opens the source of a redirection. Returns the file descriptor to move onto redir->fd, or -1 to
+// close redir->fd. Sets *opened if the returned file descriptor belongs to the redirection. Returns
+// -2 after reporting an error.
+static int open_source(const Redir *redir, bool *opened) {
+    *opened = true;
+    switch (redir->mode) {
+        case REDIR_HEREDOC: {
+            char *contents = expand_heredoc(redir->word);
+            if (contents == NULL) {
+                return -2;
+            }
+            int fd = open_heredoc(contents);
+            free(contents);
+            if (fd < 0) {
+                perror("here-document");
+                return -2;
+            }
+            return fd;
+        }
+        case REDIR_HEREDOC_QUOTED: {
+            int fd = open_heredoc(redir->word);
+            if (fd < 0) {
+                perror("here-document");
+                return -2;
+            }
+            return fd;
+        }
+        default:
+            break;
+    }
+
+    char *word = expand_word(redir->word);
+    if (word == NULL) {
+        return -2;
+    }
+    int fd;
+    switch (redir->mode) {
+        case REDIR_DUP_INPUT:
+        case REDIR_DUP_OUTPUT:
+            *opened = false;
+            fd = parse_dup_target(word);
+            if (fd == -2) {
+                fprintf(stderr, "%s: ambiguous redirect\n", word);
+            } else if (fd >= 0 && fcntl(fd, F_GETFD) < 0) {
+                fprintf(stderr, "%d: %s\n", fd, strerror(errno));
+                fd = -2;
+            }
+            break;
+        case REDIR_HERESTRING: {
+            size_t length = strlen(word);
+            word = xrealloc(word, length + 2);
+            word[length] = '\n';
+            word[length + 1] = '\0';
+            fd = open_heredoc(word);
+            if (fd < 0) {
+                perror("here-string");
+                fd = -2;
+            }
+            break;
+        }
+        default: {
+            int flags = O_CLOEXEC;
+            if (redir->mode == REDIR_INPUT) {
+                flags |= O_RDONLY;
+            } else {
+                flags |= O_WRONLY | O_CREAT | (redir->mode == REDIR_APPEND ? O_APPEND : O_TRUNC);
+            }
+            fd = open(word, flags, 0644);
+            if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", word, strerror(errno));
+                fd = -2;
+            }
+            break;
+        }
+    }
+    free(word);
+    return fd;
+}
+
+bool redir_do(Redir *redir, bool restorable) {
+    bool opened;
+    int source_fd = open_source(redir, &opened);
+    if (source_fd == -2) {
+        return false;
+    }
+
+    // The saved descriptor is closed on exec so that commands never inherit it. It is -1 if the
+    // descriptor was not open, in which case undoing the redirection closes it again.
+    redir->saved_fd = restorable ? fcntl(redir->fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN) : -1;
+
+    if (source_fd == -1) {
+        close(redir->fd);
+    } else if (source_fd != redir->fd) {
+        dup2(source_fd, redir->fd);
+        if (opened) {
+            close(source_fd);
+        }
+    } else if (opened) {
+        // The file was opened on the target descriptor itself, so it must survive an exec.
+        fcntl(source_fd, F_SETFD, 0);
+    }
+    return true;
 }
 
 void redir_undo(Redir *redir) {
-    fsync(redir->fd);
+    if (redir->saved_fd < 0) {
+        close(redir->fd);
+        return;
+    }
     dup2(redir->saved_fd, redir->fd);
     close(redir->saved_fd);
+    redir->saved_fd = -1;
 }
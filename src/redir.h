@@ -1,23 +1,42 @@
 #ifndef CODECRAFTERS_SHELL_REDIR_H_INCLUDED
 #define CODECRAFTERS_SHELL_REDIR_H_INCLUDED
 
+#include <stdbool.h>
+#include <stdio.h>
+
 typedef enum {
-    REDIR_NORMAL,
+    REDIR_INPUT,
+    REDIR_OUTPUT,
     REDIR_APPEND,
+    REDIR_DUP_INPUT,
+    REDIR_DUP_OUTPUT,
+    REDIR_HEREDOC,
+    REDIR_HEREDOC_QUOTED,
+    REDIR_HERESTRING,
 } RedirMode;
 
 typedef struct Redir Redir;
 
-// Allocates memory for an IO redirection.
-Redir *redir_create(int fd, const char *path, RedirMode mode);
+// Allocates memory for an IO redirection. The word is a path, a file descriptor to duplicate or '-'
+// to close the descriptor, the body of a here-document, or a here-string.
+Redir *redir_create(int fd, const char *word, RedirMode mode);
 
 // Deallocates memory for an IO redirection.
 void redir_destroy(void *redir);
 
-// Does an IO redirection.
-void redir_do(Redir *redir);
+// Writes an IO redirection to a stream in a form that redir_read() reads back.
+void redir_write(const Redir *redir, FILE *stream);
+
+// Reads an IO redirection written by redir_write(). Returns NULL if the data is truncated or
+// malformed.
+Redir *redir_read(FILE *stream);
+
+// Does an IO redirection. If it is restorable, the original file descriptor is saved so that it can
+// be undone; a child that is about to exec does not need that. Returns false and reports an error
+// if the redirection fails.
+bool redir_do(Redir *redir, bool restorable);
 
-// Undoes an IO redirection.
+// Undoes a restorable IO redirection.
 void redir_undo(Redir *redir);
 
 #endif
@@ -1,23 +1,39 @@
 #include "scan.h"
 #include "ptr_array.h"
+#include "str_buf.h"
 #include "token.h"
 #include "xmalloc.h"
 
 #include <ctype.h>
-#include <err.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// A here-document whose delimiter has been scanned but whose body starts after the next newline.
+typedef struct {
+    Token *token;
+    bool strip_tabs;
+} PendingHeredoc;
 
 static struct {
     const char *start;
     const char *current;
     PtrArray *tokens;
+    PtrArray *heredocs;
+    bool incomplete;
+    // The first syntax error in the input, or empty.
+    char error[64];
 } scanner;
 
 static void init(const char *line) {
     scanner.start = line;
     scanner.current = line;
     scanner.tokens = ptr_array_create();
+    scanner.heredocs = ptr_array_create();
+    scanner.incomplete = false;
+    scanner.error[0] = '\0';
 }
 
 static char peek(void) {
@@ -40,6 +56,25 @@ static bool match(char expected) {
     return true;
 }
 
+// Records a syntax error and moves to the end of the input, which ends every scanning loop.
+__attribute__((format(printf, 1, 2)))
+static void error(const char *format, ...) {
+    if (scanner.error[0] == '\0') {
+        va_list ap;
+        va_start(ap, format);
+        vsnprintf(scanner.error, sizeof(scanner.error), format, ap);
+        va_end(ap);
+    }
+    scanner.current += strlen(scanner.current);
+}
+
+// Moves past characters other than the given special ones, and returns the one it stops at. Long
+// lines are mostly such runs, which strcspn() compares many bytes of at a time.
+static char skip_ordinary(const char *special) {
+    scanner.current += strcspn(scanner.current, special);
+    return peek();
+}
+
 static char *get_lexeme(void) {
     size_t lexeme_length = scanner.current - scanner.start;
     return xstrndup(scanner.start, lexeme_length);
@@ -51,32 +86,120 @@ static void add_token(TokenType type) {
 }
 
 static void single_quote(void) {
-    while (!is_at_end() && peek() != '\'') {
-        advance();
+    scanner.current = strchrnul(scanner.current, '\'');
+    if (is_at_end()) {
+        error("missing single quote");
+        return;
+    }
+    advance();
+}
+
+static void group(char open, char close);
+
+static void backquote(void) {
+    while (skip_ordinary("`\\") != '\0' && peek() != '`') {
+        if (advance() == '\\' && !is_at_end()) {
+            advance();
+        }
     }
     if (is_at_end()) {
-        errx(EXIT_FAILURE, "missing single quote");
+        error("missing backquote");
+        return;
     }
     advance();
 }
 
+// Scans the rest of a $(...) or ${...} group after a '$', when one starts at the current character.
+static void dollar(void) {
+    if (peek() == '(') {
+        advance();
+        group('(', ')');
+    } else if (peek() == '{') {
+        advance();
+        group('{', '}');
+    }
+}
+
 static void double_quote(void) {
-    while (!is_at_end() && peek() != '\"') {
-        if (advance() == '\\') {
-            if (is_at_end()) {
-                errx(EXIT_FAILURE, "expected character after backslash");
-            }
-            advance();
+    while (skip_ordinary("\"\\$`") != '\0' && peek() != '\"') {
+        switch (advance()) {
+            case '\\':
+                if (is_at_end()) {
+                    error("expected character after backslash");
+                    return;
+                }
+                advance();
+                break;
+            case '$':
+                dollar();
+                break;
+            case '`':
+                backquote();
+                break;
+            default:
+                break;
         }
     }
     if (is_at_end()) {
-        errx(EXIT_FAILURE, "missing double quote");
+        error("missing double quote");
+        return;
     }
     advance();
 }
 
+// Scans a group up to its closing character, so that the text of a command substitution or a
+// parameter expansion stays in one word even if it holds blanks or operators.
+static void group(char open, char close) {
+    const char special[] = {'\'', '\"', '`', '$', '\\', open, close, '\0'};
+    while (skip_ordinary(special) != '\0') {
+        char c = advance();
+        if (c == close) {
+            return;
+        }
+        switch (c) {
+            case '\'':
+                single_quote();
+                break;
+            case '\"':
+                double_quote();
+                break;
+            case '`':
+                backquote();
+                break;
+            case '$':
+                dollar();
+                break;
+            case '\\':
+                if (!is_at_end()) {
+                    advance();
+                }
+                break;
+            default:
+                if (c == open) {
+                    group(open, close);
+                }
+                break;
+        }
+    }
+    error("missing '%c'", close);
+}
+
+// The characters that end a word or start something special in it. The blanks are those that
+// isspace() accepts in the C locale.
+#define WORD_SPECIAL " \t\n\v\f\r|&;<>'\"\\$`"
+
+static bool is_metachar(char c) {
+    return isspace(c) || c == '|' || c == '&' || c == ';' || c == '<' || c == '>';
+}
+
+// Checks whether a process substitution, <(...) or >(...), starts at the current character.
+static bool is_process_substitution(void) {
+    return (peek() == '<' || peek() == '>') && scanner.current[1] == '(';
+}
+
 static void word(void) {
-    while (!is_at_end() && !isspace(peek())) {
+    while (skip_ordinary(WORD_SPECIAL) != '\0' &&
+           (!is_metachar(peek()) || is_process_substitution())) {
         switch (advance()) {
             case '\'':
                 single_quote();
@@ -85,10 +208,23 @@ static void word(void) {
                 double_quote();
                 break;
             case '\\':
+                // The word still ends in a token, which a here-document operator expects.
                 if (is_at_end()) {
-                    errx(EXIT_FAILURE, "expected character after backslash");
+                    error("expected character after backslash");
+                } else {
+                    advance();
                 }
+                break;
+            case '$':
+                dollar();
+                break;
+            case '`':
+                backquote();
+                break;
+            case '<':
+            case '>':
                 advance();
+                group('(', ')');
                 break;
             default:
                 break;
@@ -97,31 +233,210 @@ static void word(void) {
     add_token(TOKEN_WORD);
 }
 
+// Scans an arithmetic command, ((expression)), as one token.
+static void arithmetic(void) {
+    int depth = 0;
+    while (skip_ordinary("()'\"`$") != '\0') {
+        switch (advance()) {
+            case '(':
+                depth++;
+                break;
+            case ')':
+                if (depth > 0) {
+                    depth--;
+                } else if (match(')')) {
+                    add_token(TOKEN_ARITH);
+                    return;
+                } else {
+                    error("missing '))'");
+                }
+                break;
+            case '\'':
+                single_quote();
+                break;
+            case '\"':
+                double_quote();
+                break;
+            case '`':
+                backquote();
+                break;
+            case '$':
+                dollar();
+                break;
+            default:
+                break;
+        }
+    }
+    error("missing '))'");
+}
+
 static void number(void) {
     while (!is_at_end() && isdigit(peek())) {
         advance();
     }
 
-    if (peek() == '>') {
+    if (peek() == '<' || peek() == '>') {
         add_token(TOKEN_IO_NUMBER);
     } else {
         word();
     }
 }
 
+// Removes quotes from a here-document delimiter, recording whether there were any.
+static char *unquote(const char *lexeme, bool *quoted) {
+    StrBuf *delimiter = str_buf_create();
+    *quoted = false;
+    for (const char *p = lexeme; *p != '\0'; p++) {
+        if (*p == '\'' || *p == '\"') {
+            *quoted = true;
+        } else if (*p == '\\' && p[1] != '\0') {
+            *quoted = true;
+            str_buf_append_char(delimiter, *++p);
+        } else {
+            str_buf_append_char(delimiter, *p);
+        }
+    }
+    return str_buf_release(delimiter);
+}
+
+// Reads the body of a here-document up to the line holding only its delimiter. Returns false if the
+// input ends first.
+static bool read_heredoc(PendingHeredoc *heredoc) {
+    bool quoted;
+    char *delimiter = unquote(heredoc->token->lexeme, &quoted);
+    size_t delimiter_length = strlen(delimiter);
+    StrBuf *body = str_buf_create();
+
+    bool found = false;
+    for (;;) {
+        const char *line = scanner.current;
+        if (heredoc->strip_tabs) {
+            while (*line == '\t') {
+                line++;
+            }
+        }
+        const char *end = strchrnul(line, '\n');
+        if ((size_t)(end - line) == delimiter_length && memcmp(line, delimiter, end - line) == 0) {
+            scanner.current = *end == '\n' ? end + 1 : end;
+            found = true;
+            break;
+        }
+        if (*end == '\0') {
+            break;
+        }
+        str_buf_append_n(body, line, end - line + 1);
+        scanner.current = end + 1;
+    }
+    free(delimiter);
+
+    if (!found) {
+        str_buf_destroy(body);
+        return false;
+    }
+    free(heredoc->token->lexeme);
+    heredoc->token->lexeme = str_buf_release(body);
+    heredoc->token->type = quoted ? TOKEN_HEREDOC_QUOTED : TOKEN_HEREDOC;
+    return true;
+}
+
+// Reads the bodies of the here-documents started on the line that just ended.
+static void read_heredocs(void) {
+    size_t num_heredocs = ptr_array_get_size(scanner.heredocs);
+    for (size_t i = 0; i < num_heredocs && !scanner.incomplete; i++) {
+        if (!read_heredoc(ptr_array_get(scanner.heredocs, i))) {
+            scanner.incomplete = true;
+        }
+    }
+    while (!ptr_array_is_empty(scanner.heredocs)) {
+        free(ptr_array_pop(scanner.heredocs));
+    }
+}
+
+static void heredoc(TokenType type) {
+    add_token(type);
+    while (peek() == ' ' || peek() == '\t') {
+        advance();
+    }
+    if (is_at_end() || is_metachar(peek())) {
+        // The parser reports the missing delimiter.
+        return;
+    }
+
+    scanner.start = scanner.current;
+    word();
+    PendingHeredoc *pending = xmalloc(sizeof(PendingHeredoc));
+    pending->token = ptr_array_get(scanner.tokens, ptr_array_get_size(scanner.tokens) - 1);
+    pending->strip_tabs = type == TOKEN_DLESSDASH;
+    ptr_array_append(scanner.heredocs, pending);
+}
+
+static void less(void) {
+    if (match('<')) {
+        if (match('<')) {
+            add_token(TOKEN_TLESS);
+        } else {
+            heredoc(match('-') ? TOKEN_DLESSDASH : TOKEN_DLESS);
+        }
+    } else {
+        add_token(match('&') ? TOKEN_LESSAND : TOKEN_LESS);
+    }
+}
+
 static void scan_token(void) {
     char c = peek();
     switch (c) {
         case '|':
             advance();
-            add_token(TOKEN_OR);
+            add_token(match('|') ? TOKEN_OR_IF : TOKEN_OR);
+            break;
+        case '&':
+            advance();
+            add_token(match('&') ? TOKEN_AND_IF : TOKEN_AND);
+            break;
+        case ';':
+            advance();
+            add_token(TOKEN_SEMI);
+            break;
+        case '\n':
+            advance();
+            add_token(TOKEN_NEWLINE);
+            read_heredocs();
             break;
         case ' ':
+        case '\t':
+            advance();
+            break;
+        case '#':
+            // A comment runs to the end of the line, whose newline still ends the command.
+            scanner.current = strchrnul(scanner.current, '\n');
+            break;
+        case '<':
+            if (is_process_substitution()) {
+                word();
+                break;
+            }
             advance();
+            less();
+            break;
+        case '(':
+            if (scanner.current[1] == '(') {
+                scanner.current += 2;
+                arithmetic();
+            } else {
+                word();
+            }
             break;
         case '>':
+            if (is_process_substitution()) {
+                word();
+                break;
+            }
             advance();
-            add_token(match('>') ? TOKEN_DGREAT : TOKEN_GREAT);
+            if (match('>')) {
+                add_token(TOKEN_DGREAT);
+            } else {
+                add_token(match('&') ? TOKEN_GREATAND : TOKEN_GREAT);
+            }
             break;
         default:
             if (isdigit(c)) {
@@ -135,10 +450,22 @@ static void scan_token(void) {
 
 PtrArray *scan(const char *line) {
     init(line);
-    while (!is_at_end()) {
+    while (!is_at_end() && !scanner.incomplete) {
         scan_token();
         scanner.start = scanner.current;
     }
+
+    if (scanner.error[0] != '\0' || scanner.incomplete ||
+        !ptr_array_is_empty(scanner.heredocs)) {
+        ptr_array_destroy(scanner.heredocs, free);
+        ptr_array_destroy(scanner.tokens, token_destroy);
+        return NULL;
+    }
+    ptr_array_destroy(scanner.heredocs, free);
     add_token(TOKEN_EOF);
     return scanner.tokens;
 }
+
+const char *scan_get_error(void) {
+    return scanner.error[0] != '\0' ? scanner.error : NULL;
+}
@@ -3,7 +3,12 @@
 
 #include "ptr_array.h"
 
-// Tokenizes a line.
+// Tokenizes one or more lines. Returns NULL on a syntax error, or if the input ends inside a
+// here-document, in which case the caller should append the next line and scan again.
 PtrArray *scan(const char *line);
 
+// Returns the syntax error that made the last scan() fail, or NULL if the input ended inside a
+// here-document instead.
+const char *scan_get_error(void);
+
 #endif
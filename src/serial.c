@@ -0,0 +1,36 @@
+#include "serial.h"
+#include "xmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Strings longer than this are taken as a sign of corrupt data rather than allocated.
+#define MAX_STRING_LENGTH (1u << 30)
+
+void serial_write_u64(FILE *stream, uint64_t value) {
+    fwrite(&value, sizeof(value), 1, stream);
+}
+
+bool serial_read_u64(FILE *stream, uint64_t *value) {
+    return fread(value, sizeof(*value), 1, stream) == 1;
+}
+
+void serial_write_string(FILE *stream, const char *s) {
+    size_t length = strlen(s);
+    serial_write_u64(stream, length);
+    fwrite(s, 1, length, stream);
+}
+
+char *serial_read_string(FILE *stream) {
+    uint64_t length;
+    if (!serial_read_u64(stream, &length) || length > MAX_STRING_LENGTH) {
+        return NULL;
+    }
+    char *s = xmalloc(length + 1);
+    if (fread(s, 1, length, stream) != length || memchr(s, '\0', length) != NULL) {
+        free(s);
+        return NULL;
+    }
+    s[length] = '\0';
+    return s;
+}
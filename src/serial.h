@@ -0,0 +1,22 @@
+#ifndef CODECRAFTERS_SHELL_SERIAL_H_INCLUDED
+#define CODECRAFTERS_SHELL_SERIAL_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Writes an unsigned integer to a stream in native byte order. Serialized data is only read back on
+// the machine that wrote it.
+void serial_write_u64(FILE *stream, uint64_t value);
+
+// Reads an unsigned integer written by serial_write_u64(). Returns false if the stream ends first.
+bool serial_read_u64(FILE *stream, uint64_t *value);
+
+// Writes a string to a stream, preceded by its length.
+void serial_write_string(FILE *stream, const char *s);
+
+// Reads a string written by serial_write_string() into a dynamically allocated string. Returns NULL
+// if the stream ends first.
+char *serial_read_string(FILE *stream);
+
+#endif
@@ -0,0 +1,253 @@
+#include "server.h"
+#include "cmd.h"
+#include "jobs.h"
+#include "parse.h"
+#include "ptr_array.h"
+#include "scan.h"
+#include "token.h"
+#include "xmalloc.h"
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Longer command text is taken as a sign of a broken client rather than allocated.
+#define MAX_REQUEST_LENGTH (64u * 1024 * 1024)
+
+// A forked copy of the shell that runs one request, and the connection that its reply goes to.
+typedef struct {
+    Job *job;
+    int fd;
+} Worker;
+
+static bool is_listening(const struct sockaddr_un *addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return true;
+    }
+    bool listening = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0 ||
+                     errno != ECONNREFUSED;
+    close(fd);
+    return listening;
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errx(EXIT_FAILURE, "%s: socket path too long", path);
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        err(EXIT_FAILURE, "socket");
+    }
+    if (bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        // A socket left behind by a server that is gone is replaced, but a live one is not.
+        if (errno != EADDRINUSE || is_listening(&addr) || unlink(path) < 0 ||
+            bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            err(EXIT_FAILURE, "%s", path);
+        }
+    }
+    // Nobody can connect before listen(), so the socket is private from the start.
+    if (chmod(path, 0600) < 0) {
+        err(EXIT_FAILURE, "%s", path);
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        err(EXIT_FAILURE, "listen");
+    }
+    return fd;
+}
+
+// Closes every descriptor that a message carries, however many the client sent.
+static void close_received(struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < num_fds; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            close(fd);
+        }
+    }
+}
+
+// Receives the file descriptors of a request, which replace the standard ones, and its command
+// text. Returns NULL if the request is malformed.
+static char *receive_request(int conn) {
+    uint64_t length;
+    struct iovec iov = {.iov_base = &length, .iov_len = sizeof(length)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * SERVER_NUM_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    ssize_t num_received;
+    while ((num_received = recvmsg(conn, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC)) < 0 &&
+           errno == EINTR) {
+    }
+    if (num_received < 0) {
+        msg.msg_controllen = 0;
+    }
+
+    // The control buffer is padded, so it can take a descriptor more than asked for without the
+    // kernel truncating; only a message with exactly the expected number is accepted.
+    int fds[SERVER_NUM_FDS];
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    bool has_fds = cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+                   cmsg->cmsg_type == SCM_RIGHTS &&
+                   cmsg->cmsg_len == CMSG_LEN(sizeof(int) * SERVER_NUM_FDS);
+    if (num_received != sizeof(length) || !has_fds || (msg.msg_flags & MSG_CTRUNC) != 0 ||
+        length > MAX_REQUEST_LENGTH) {
+        close_received(&msg);
+        return NULL;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    char *text = xmalloc(length + 1);
+    size_t num_read = 0;
+    while (num_read < length) {
+        ssize_t n = read(conn, text + num_read, length - num_read);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            free(text);
+            close_received(&msg);
+            return NULL;
+        }
+        num_read += n;
+    }
+    text[length] = '\0';
+    if (memchr(text, '\0', length) != NULL) {
+        free(text);
+        close_received(&msg);
+        return NULL;
+    }
+
+    // The standard descriptors are open in the worker, so the received ones are all above them.
+    for (int i = 0; i < SERVER_NUM_FDS; i++) {
+        dup2(fds[i], i);
+    }
+    close_received(&msg);
+    return text;
+}
+
+// Runs a request in a worker, which exits with the status of its last pipeline.
+__attribute__((noreturn)) static void serve(int conn) {
+    char *text = receive_request(conn);
+    close(conn);
+    if (text == NULL) {
+        fprintf(stderr, "server: malformed request\n");
+        exit(2);
+    }
+
+    PtrArray *tokens = scan(text);
+    free(text);
+    if (tokens == NULL) {
+        const char *error = scan_get_error();
+        fprintf(stderr, "%s\n", error != NULL ? error : "unexpected end of file in here-document");
+        exit(2);
+    }
+    PtrArray *pipelines = parse(tokens);
+    ptr_array_destroy(tokens, token_destroy);
+    if (pipelines == NULL) {
+        exit(2);
+    }
+    execute_pipelines(pipelines);
+    exit(get_last_status());
+}
+
+static void accept_request(int listen_fd, PtrArray *workers) {
+    int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0) {
+        if (errno != EINTR && errno != ECONNABORTED) {
+            warn("accept");
+        }
+        return;
+    }
+    // The socket mode already keeps other users out, but not on systems that ignore it.
+    struct ucred cred;
+    socklen_t cred_size = sizeof(cred);
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_size) < 0 ||
+        cred.uid != geteuid()) {
+        close(conn);
+        return;
+    }
+
+    Job *job = job_create("server request", true);
+    if (job_fork(job) == 0) {
+        close(listen_fd);
+        size_t num_workers = ptr_array_get_size(workers);
+        for (size_t i = 0; i < num_workers; i++) {
+            close(((const Worker *)ptr_array_get_const(workers, i))->fd);
+        }
+        serve(conn);
+    }
+
+    Worker *worker = xmalloc(sizeof(Worker));
+    worker->job = job;
+    worker->fd = conn;
+    ptr_array_append(workers, worker);
+}
+
+// Replies to the requests whose workers have exited.
+static void reply_to_finished(PtrArray *workers) {
+    for (size_t i = ptr_array_get_size(workers); i-- > 0;) {
+        Worker *worker = ptr_array_get(workers, i);
+        if (!job_is_done(worker->job)) {
+            continue;
+        }
+
+        ServerReply reply;
+        memset(&reply, 0, sizeof(reply));
+        job_get_usage(worker->job, &reply.usage);
+        int status;
+        reply.status = job_wait(worker->job, &status);
+        // A client that has gone away only loses its reply.
+        send(worker->fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+        close(worker->fd);
+        free(worker);
+
+        ptr_array_set(workers, i, ptr_array_get(workers, ptr_array_get_size(workers) - 1));
+        ptr_array_pop(workers);
+    }
+}
+
+void server_run(const char *path) {
+    int listen_fd = listen_on(path);
+    PtrArray *workers = ptr_array_create();
+
+    struct pollfd fds[] = {
+        {.fd = listen_fd, .events = POLLIN},
+        {.fd = jobs_get_event_fd(), .events = POLLIN},
+    };
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err(EXIT_FAILURE, "poll");
+        }
+        if (fds[1].revents != 0) {
+            jobs_notify();
+            reply_to_finished(workers);
+        }
+        if (fds[0].revents != 0) {
+            accept_request(listen_fd, workers);
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef CODECRAFTERS_SHELL_SERVER_H_INCLUDED
+#define CODECRAFTERS_SHELL_SERVER_H_INCLUDED
+
+#include <stdint.h>
+#include <sys/resource.h>
+
+// The number of file descriptors that a client passes with a request: the standard input, output
+// and error of the command.
+#define SERVER_NUM_FDS 3
+
+// The reply to a request, in the layout of this structure on the machine of the server.
+typedef struct {
+    int32_t status;
+    struct rusage usage;
+} ServerReply;
+
+// Serves command lines over a Unix domain socket at the given path (shell --server PATH). Each
+// connection carries one request: a uint64_t length in native byte order, sent together with the
+// SCM_RIGHTS message that passes SERVER_NUM_FDS file descriptors, followed by the command text. It
+// is executed in a forked copy of the shell, so requests run concurrently and start with the
+// server's variables and caches without changing them. The server replies with a ServerReply
+// holding the exit status and resource usage of that copy once it exits, and closes the
+// connection. Only the user running the server can connect: the socket has mode 0600, and
+// connections from other users are closed unanswered.
+__attribute__((noreturn)) void server_run(const char *path);
+
+#endif
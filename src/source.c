@@ -0,0 +1,323 @@
+#include "source.h"
+#include "cmd.h"
+#include "misc.h"
+#include "parse.h"
+#include "scan.h"
+#include "serial.h"
+#include "str_buf.h"
+#include "token.h"
+#include "var.h"
+#include "xmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "SHPC"
+
+// Bumped whenever the serialized form of a pipeline changes, so that older cache files are ignored.
+#define CACHE_VERSION 3
+
+// What identifies one version of a file. A file that is rewritten in place within the resolution of
+// its timestamp keeps its key unless its size changes too.
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+} FileKey;
+
+typedef struct {
+    FileKey key;
+    PtrArray *pipelines;
+    // Sourcing that is running the pipelines, which must outlive it even if the file changes.
+    int depth;
+} CacheEntry;
+
+static PtrArray *cache = NULL;
+
+static FileKey get_key(const struct stat *st) {
+    return (FileKey){st->st_dev, st->st_ino, st->st_mtim, st->st_size};
+}
+
+static bool is_same_file(const FileKey *a, const FileKey *b) {
+    return a->dev == b->dev && a->ino == b->ino;
+}
+
+static bool is_same_version(const FileKey *a, const FileKey *b) {
+    return is_same_file(a, b) && a->mtime.tv_sec == b->mtime.tv_sec &&
+           a->mtime.tv_nsec == b->mtime.tv_nsec && a->size == b->size;
+}
+
+static CacheEntry *find_entry(const FileKey *key) {
+    if (cache == NULL) {
+        cache = ptr_array_create();
+    }
+    size_t num_entries = ptr_array_get_size(cache);
+    for (size_t i = 0; i < num_entries; i++) {
+        CacheEntry *entry = ptr_array_get(cache, i);
+        if (is_same_file(&entry->key, key)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Checks that a cache file or directory belongs to the user and that no one else can write to it.
+// Loading a cache file runs its commands, so one that someone else could have planted is ignored.
+static bool is_private(const struct stat *st) {
+    return st->st_uid == geteuid() && (st->st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Returns the path of the cache file for a file, or NULL if there is no private cache directory.
+static char *get_cache_path(const FileKey *key) {
+    const char *dir = var_get("SOURCE_CACHE_DIR");
+    struct stat st;
+    if (dir == NULL || dir[0] == '\0' || stat(dir, &st) < 0 || !S_ISDIR(st.st_mode) ||
+        !is_private(&st)) {
+        return NULL;
+    }
+    char *path;
+    if (asprintf(&path, "%s/%llx-%llx.parsed", dir, (unsigned long long)key->dev,
+                 (unsigned long long)key->ino) < 0) {
+        return NULL;
+    }
+    return path;
+}
+
+static void write_key(const FileKey *key, FILE *stream) {
+    serial_write_u64(stream, key->dev);
+    serial_write_u64(stream, key->ino);
+    serial_write_u64(stream, key->mtime.tv_sec);
+    serial_write_u64(stream, key->mtime.tv_nsec);
+    serial_write_u64(stream, key->size);
+}
+
+static bool read_key(FILE *stream, FileKey *key) {
+    uint64_t fields[5];
+    for (size_t i = 0; i < 5; i++) {
+        if (!serial_read_u64(stream, &fields[i])) {
+            return false;
+        }
+    }
+    *key = (FileKey){fields[0], fields[1], {fields[2], fields[3]}, fields[4]};
+    return true;
+}
+
+// Hashes the text of a file with FNV-1a, so that a cache file is only used for the text it was
+// parsed from even if the file was rewritten without changing its size or timestamp.
+static uint64_t get_checksum(const char *text) {
+    uint64_t hash = 14695981039346656037u;
+    for (const char *p = text; *p != '\0'; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+// Loads the pipelines of a file from the disk cache. Returns NULL if there is no cache file for
+// this version of the file or it cannot be read.
+static PtrArray *load_cached(const FileKey *key, uint64_t checksum) {
+    char *path = get_cache_path(key);
+    if (path == NULL) {
+        return NULL;
+    }
+    FILE *stream = fopen(path, "rbe");
+    free(path);
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    char magic[sizeof(CACHE_MAGIC) - 1];
+    uint64_t version, cached_checksum, num_pipelines;
+    FileKey cached_key;
+    PtrArray *pipelines = NULL;
+    struct stat st;
+    if (fstat(fileno(stream), &st) == 0 && S_ISREG(st.st_mode) && is_private(&st) &&
+        fread(magic, 1, sizeof(magic), stream) == sizeof(magic) &&
+        memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0 && serial_read_u64(stream, &version) &&
+        version == CACHE_VERSION && read_key(stream, &cached_key) &&
+        is_same_version(&cached_key, key) && serial_read_u64(stream, &cached_checksum) &&
+        cached_checksum == checksum && serial_read_u64(stream, &num_pipelines)) {
+        pipelines = ptr_array_create();
+        for (uint64_t i = 0; i < num_pipelines; i++) {
+            Pipeline *pipeline = pipeline_read(stream);
+            if (pipeline == NULL) {
+                ptr_array_destroy(pipelines, pipeline_destroy);
+                pipelines = NULL;
+                break;
+            }
+            ptr_array_append(pipelines, pipeline);
+        }
+    }
+    fclose(stream);
+    return pipelines;
+}
+
+// Saves the pipelines of a file to the disk cache. The cache file is written under a temporary name
+// and renamed, so that a shell reading it concurrently sees either the old or the new one.
+static void save_cached(const FileKey *key, uint64_t checksum, const PtrArray *pipelines) {
+    char *path = get_cache_path(key);
+    if (path == NULL) {
+        return;
+    }
+    size_t size = strlen(path) + sizeof(".XXXXXX");
+    char *temp_path = xmalloc(size);
+    snprintf(temp_path, size, "%s.XXXXXX", path);
+    int fd = mkstemp(temp_path);
+    FILE *stream = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (stream == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(temp_path);
+        }
+        free(temp_path);
+        free(path);
+        return;
+    }
+
+    fwrite(CACHE_MAGIC, 1, sizeof(CACHE_MAGIC) - 1, stream);
+    serial_write_u64(stream, CACHE_VERSION);
+    write_key(key, stream);
+    serial_write_u64(stream, checksum);
+    size_t num_pipelines = ptr_array_get_size(pipelines);
+    serial_write_u64(stream, num_pipelines);
+    for (size_t i = 0; i < num_pipelines; i++) {
+        pipeline_write(ptr_array_get_const(pipelines, i), stream);
+    }
+    bool failed = ferror(stream) != 0;
+    if (fclose(stream) != 0 || failed || rename(temp_path, path) < 0) {
+        unlink(temp_path);
+    }
+    free(temp_path);
+    free(path);
+}
+
+static char *read_file(int fd) {
+    StrBuf *text = str_buf_create();
+    char buf[BUFSIZ];
+    for (;;) {
+        ssize_t num_read = read(fd, buf, sizeof(buf));
+        if (num_read < 0 && errno == EINTR) {
+            continue;
+        } else if (num_read < 0) {
+            str_buf_destroy(text);
+            return NULL;
+        } else if (num_read == 0) {
+            return str_buf_release(text);
+        }
+        str_buf_append_n(text, buf, num_read);
+    }
+}
+
+// Scans and parses the text of a file. Returns NULL after reporting an error.
+static PtrArray *parse_text(const char *cmd_name, const char *name, const char *text) {
+    PtrArray *tokens = scan(text);
+    if (tokens == NULL) {
+        const char *error = scan_get_error();
+        fprintf(stderr, "%s: %s: %s\n", cmd_name, name,
+                error != NULL ? error : "unexpected end of file in here-document");
+        return NULL;
+    }
+    PtrArray *pipelines = parse(tokens);
+    ptr_array_destroy(tokens, token_destroy);
+    return pipelines;
+}
+
+// Opens the file that a source argument names. A name without a slash is looked up under PATH
+// first, then in the current directory.
+static int open_source_file(const char *name) {
+    char *path = strchr(name, '/') == NULL ? find_readable_file(name) : NULL;
+    int fd = open(path != NULL ? path : name, O_RDONLY | O_CLOEXEC);
+    free(path);
+    return fd;
+}
+
+static int run(PtrArray *pipelines) {
+    if (ptr_array_is_empty(pipelines)) {
+        return 0;
+    }
+    execute_pipelines(pipelines);
+    return get_last_status();
+}
+
+int cmd_source(const PtrArray *arguments) {
+    const char *cmd_name = ptr_array_get_const(arguments, 0);
+    if (ptr_array_get_size(arguments) < 2) {
+        fprintf(stderr, "%s: filename argument required\n", cmd_name);
+        return 2;
+    }
+    const char *name = ptr_array_get_const(arguments, 1);
+
+    int fd = open_source_file(name);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s: %s\n", cmd_name, name, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    } else if (S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "%s: %s: %s\n", cmd_name, name, strerror(EISDIR));
+        close(fd);
+        return 1;
+    }
+
+    // Only regular files can be recognized again; anything else is read afresh every time.
+    FileKey key = get_key(&st);
+    CacheEntry *entry = S_ISREG(st.st_mode) ? find_entry(&key) : NULL;
+    if (entry != NULL && is_same_version(&entry->key, &key)) {
+        close(fd);
+        entry->depth++;
+        int status = run(entry->pipelines);
+        entry->depth--;
+        return status;
+    }
+
+    char *text = read_file(fd);
+    close(fd);
+    if (text == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", cmd_name, name, strerror(errno));
+        return 1;
+    }
+    uint64_t checksum = get_checksum(text);
+    PtrArray *pipelines = S_ISREG(st.st_mode) ? load_cached(&key, checksum) : NULL;
+    bool parsed = pipelines == NULL;
+    if (parsed) {
+        pipelines = parse_text(cmd_name, name, text);
+    }
+    free(text);
+    if (pipelines == NULL) {
+        return 2;
+    }
+    if (parsed && S_ISREG(st.st_mode)) {
+        save_cached(&key, checksum, pipelines);
+    }
+
+    // A file that changed while it was being sourced keeps its old pipelines until that finishes,
+    // and its new ones are only used once.
+    if (!S_ISREG(st.st_mode) || (entry != NULL && entry->depth > 0)) {
+        int status = run(pipelines);
+        ptr_array_destroy(pipelines, pipeline_destroy);
+        return status;
+    }
+    if (entry == NULL) {
+        entry = xmalloc(sizeof(CacheEntry));
+        entry->pipelines = NULL;
+        entry->depth = 0;
+        ptr_array_append(cache, entry);
+    }
+    if (entry->pipelines != NULL) {
+        ptr_array_destroy(entry->pipelines, pipeline_destroy);
+    }
+    entry->key = key;
+    entry->pipelines = pipelines;
+    entry->depth++;
+    int status = run(pipelines);
+    entry->depth--;
+    return status;
+}
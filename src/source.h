@@ -0,0 +1,12 @@
+#ifndef CODECRAFTERS_SHELL_SOURCE_H_INCLUDED
+#define CODECRAFTERS_SHELL_SOURCE_H_INCLUDED
+
+#include "ptr_array.h"
+
+// Executes the commands in a file in the current shell (the . and source builtins). Parsed files
+// are cached in memory, and on disk under SOURCE_CACHE_DIR when it is set, until they change. The
+// directory and its cache files are only used if they belong to the user and only the user can
+// write to them.
+int cmd_source(const PtrArray *arguments);
+
+#endif
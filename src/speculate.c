@@ -0,0 +1,190 @@
+#include "speculate.h"
+#include "misc.h"
+#include "var.h"
+#include "xmalloc.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <readline/readline.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Larger executables are only read ahead in part, which covers what starting them touches first.
+#define MAX_READAHEAD (8 * 1024 * 1024)
+
+// A command name for the resolver thread, with the paths to try for it. The resolver only makes
+// system calls on them, so it shares nothing else with the shell.
+typedef struct {
+    char *name;
+    PtrArray *candidates;
+    // The PATH that the candidates come from, as var_get_path_generation() numbers it.
+    unsigned long path_generation;
+    // Set by the resolver to the candidate that is executable, if any.
+    const char *found;
+} Request;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool started;
+    // The latest name to resolve, which replaces one that the resolver has not taken yet.
+    Request *pending;
+    // The last name resolved, for the shell to remember.
+    Request *done;
+} resolver = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, NULL, NULL};
+
+// The command name that was last resolved, so that an unchanged line costs nothing.
+static char *last_name = NULL;
+
+static void request_destroy(Request *request) {
+    if (request == NULL) {
+        return;
+    }
+    free(request->name);
+    ptr_array_destroy(request->candidates, free);
+    free(request);
+}
+
+static bool is_name_char(char c) {
+    return isalnum((unsigned char)c) || (c != '\0' && strchr("_./+-", c) != NULL);
+}
+
+// Starts reading an executable into the page cache without waiting for the disk. Only regular files
+// are opened, and without blocking, as opening a FIFO or a device could hang or have effects.
+static void warm(const char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return;
+    }
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        off_t length = st.st_size < MAX_READAHEAD ? st.st_size : MAX_READAHEAD;
+        if (readahead(fd, 0, length) < 0) {
+            posix_fadvise(fd, 0, length, POSIX_FADV_WILLNEED);
+        }
+    }
+    close(fd);
+}
+
+static void *resolve(void *arg) {
+    pthread_mutex_lock(&resolver.lock);
+    for (;;) {
+        while (resolver.pending == NULL) {
+            pthread_cond_wait(&resolver.wake, &resolver.lock);
+        }
+        Request *request = resolver.pending;
+        resolver.pending = NULL;
+        pthread_mutex_unlock(&resolver.lock);
+
+        size_t num_candidates = ptr_array_get_size(request->candidates);
+        for (size_t i = 0; i < num_candidates && request->found == NULL; i++) {
+            const char *path = ptr_array_get_const(request->candidates, i);
+            if (is_executable(path)) {
+                request->found = path;
+                warm(path);
+            }
+        }
+
+        pthread_mutex_lock(&resolver.lock);
+        request_destroy(resolver.done);
+        resolver.done = request;
+    }
+    return NULL;
+}
+
+// Hands the path that the resolver found last to find_executable(), if PATH is still the same. A
+// name with a slash is run as it is, without a lookup.
+static void take_result(void) {
+    pthread_mutex_lock(&resolver.lock);
+    Request *request = resolver.done;
+    resolver.done = NULL;
+    pthread_mutex_unlock(&resolver.lock);
+
+    if (request != NULL && request->found != NULL && strchr(request->name, '/') == NULL &&
+        request->path_generation == var_get_path_generation()) {
+        remember_executable(request->name, request->found);
+    }
+    request_destroy(request);
+}
+
+// Passes a name to the resolver thread, starting it the first time.
+static void submit(const char *name) {
+    Request *request = xmalloc(sizeof(Request));
+    request->name = xstrdup(name);
+    request->path_generation = var_get_path_generation();
+    request->found = NULL;
+    if (strchr(name, '/') != NULL) {
+        request->candidates = ptr_array_create();
+        ptr_array_append(request->candidates, xstrdup(name));
+    } else {
+        request->candidates = get_executable_candidates(name);
+    }
+
+    pthread_mutex_lock(&resolver.lock);
+    if (!resolver.started) {
+        pthread_t thread;
+        resolver.started = pthread_create(&thread, NULL, resolve, NULL) == 0;
+        if (resolver.started) {
+            pthread_detach(thread);
+        }
+    }
+    if (resolver.started) {
+        request_destroy(resolver.pending);
+        resolver.pending = request;
+        request = NULL;
+        pthread_cond_signal(&resolver.wake);
+    }
+    pthread_mutex_unlock(&resolver.lock);
+    request_destroy(request);
+}
+
+// Called by readline while it waits for a key. A first word that needs expanding, or is followed
+// by quotes or the like, is left for when the line runs.
+static int speculate(void) {
+    take_result();
+
+    const char *start = rl_line_buffer;
+    while (*start == ' ' || *start == '\t') {
+        start++;
+    }
+    const char *end = start;
+    while (is_name_char(*end)) {
+        end++;
+    }
+    if (end == start || (*end != '\0' && strchr(" \t\n|&;<>()", *end) == NULL)) {
+        return 0;
+    }
+
+    size_t length = end - start;
+    if (last_name != NULL && strncmp(last_name, start, length) == 0 && last_name[length] == '\0') {
+        return 0;
+    }
+    free(last_name);
+    last_name = xstrndup(start, length);
+    if (!is_builtin(last_name)) {
+        submit(last_name);
+    }
+    return 0;
+}
+
+// A child forked while the resolver held its lock would wait for it forever, and has no resolver
+// thread, so it starts afresh.
+static void reset_in_child(void) {
+    pthread_mutex_init(&resolver.lock, NULL);
+    pthread_cond_init(&resolver.wake, NULL);
+    resolver.started = false;
+    resolver.pending = NULL;
+    resolver.done = NULL;
+}
+
+void speculate_init(void) {
+    rl_event_hook = speculate;
+    pthread_atfork(NULL, NULL, reset_in_child);
+}
@@ -0,0 +1,10 @@
+#ifndef CODECRAFTERS_SHELL_SPECULATE_H_INCLUDED
+#define CODECRAFTERS_SHELL_SPECULATE_H_INCLUDED
+
+// Resolves the command name on the line being edited whenever readline is waiting for a key, and
+// starts reading the executable into the page cache, so that running it does not wait for the
+// PATH search or for the disk. The search runs in a thread of its own, so a slow PATH directory
+// does not hold up typing, and the path it finds is remembered at the next wait for a key.
+void speculate_init(void);
+
+#endif
@@ -0,0 +1,225 @@
+#include "stats.h"
+#include "autocmp.h"
+#include "misc.h"
+
+#include <inttypes.h>
+#include <readline/history.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Lookup latencies are counted in buckets of powers of two nanoseconds; the last one holds
+// everything longer.
+#define NUM_LATENCY_BUCKETS 32
+
+typedef struct {
+    _Atomic uint64_t counters[STAT_NUM_SHARED];
+} SharedStats;
+
+static SharedStats private_shared_stats;
+static SharedStats *shared_stats = &private_shared_stats;
+
+// Only the main thread of the shell updates these.
+static struct {
+    uint64_t counters[STAT_NUM_COUNTERS];
+    uint64_t lookup_latencies[NUM_LATENCY_BUCKETS];
+    // Lines read by the shell, and the allocations of the last one and of the one that made most.
+    uint64_t lines;
+    uint64_t last_line_allocations;
+    uint64_t max_line_allocations;
+} stats;
+
+// Each thread counts its allocations apart, so that threads scanning PATH do not contend for one
+// counter.
+static _Thread_local uint64_t thread_allocations;
+static _Atomic uint64_t finished_thread_allocations;
+
+void stats_init(void) {
+    SharedStats *shared =
+        mmap(NULL, sizeof(SharedStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return;
+    }
+    memcpy(shared, shared_stats, sizeof(SharedStats));
+    shared_stats = shared;
+}
+
+void stats_add(StatCounter counter, uint64_t n) {
+    if (counter < STAT_NUM_SHARED) {
+        atomic_fetch_add_explicit(&shared_stats->counters[counter], n, memory_order_relaxed);
+    } else {
+        stats.counters[counter] += n;
+    }
+}
+
+uint64_t stats_get(StatCounter counter) {
+    if (counter < STAT_NUM_SHARED) {
+        return atomic_load_explicit(&shared_stats->counters[counter], memory_order_relaxed);
+    }
+    return stats.counters[counter];
+}
+
+void stats_count_allocation(void) {
+    thread_allocations++;
+}
+
+void stats_thread_done(void) {
+    atomic_fetch_add_explicit(&finished_thread_allocations, thread_allocations,
+                              memory_order_relaxed);
+    thread_allocations = 0;
+}
+
+uint64_t stats_get_allocations(void) {
+    return thread_allocations +
+           atomic_load_explicit(&finished_thread_allocations, memory_order_relaxed);
+}
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_lookup_done(uint64_t start_ns) {
+    stats_add(STAT_LOOKUPS, 1);
+    uint64_t ns = stats_now() - start_ns;
+    size_t bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+    if (bucket >= NUM_LATENCY_BUCKETS) {
+        bucket = NUM_LATENCY_BUCKETS - 1;
+    }
+    stats.lookup_latencies[bucket]++;
+}
+
+void stats_line_done(uint64_t allocations_at_start) {
+    uint64_t allocations = stats_get_allocations() - allocations_at_start;
+    stats.lines++;
+    stats.last_line_allocations = allocations;
+    if (allocations > stats.max_line_allocations) {
+        stats.max_line_allocations = allocations;
+    }
+}
+
+// What the report shows besides the counters.
+typedef struct {
+    size_t trie_nodes;
+    size_t trie_bytes;
+    bool has_index;
+    size_t index_names;
+    double index_age;
+    size_t history_entries;
+    size_t history_bytes;
+} Sizes;
+
+static void get_sizes(Sizes *sizes) {
+    memset(sizes, 0, sizeof(*sizes));
+    autocmp_get_trie_size(&sizes->trie_nodes, &sizes->trie_bytes);
+    uint64_t built_ns;
+    sizes->has_index = get_executable_index_info(&sizes->index_names, &built_ns);
+    if (sizes->has_index) {
+        sizes->index_age = (stats_now() - built_ns) / 1e9;
+    }
+
+    HIST_ENTRY **entries = history_list();
+    for (size_t i = 0; entries != NULL && entries[i] != NULL; i++) {
+        sizes->history_entries++;
+        sizes->history_bytes += strlen(entries[i]->line) + 1;
+    }
+}
+
+static double to_seconds(StatCounter counter) {
+    return stats_get(counter) / 1e9;
+}
+
+static void print_human(const Sizes *sizes) {
+    printf("completion trie: %zu nodes, %zu bytes\n", sizes->trie_nodes, sizes->trie_bytes);
+    if (sizes->has_index) {
+        printf("executable index: %zu names, built %.1f s ago\n", sizes->index_names,
+               sizes->index_age);
+    } else {
+        printf("executable index: not built\n");
+    }
+    printf("history: %zu entries, %zu bytes\n", sizes->history_entries, sizes->history_bytes);
+
+    uint64_t lookups = stats_get(STAT_LOOKUPS);
+    uint64_t hits = stats_get(STAT_LOOKUP_HITS);
+    printf("path lookups: %" PRIu64 ", %" PRIu64 " from remembered paths (%.1f%%)\n", lookups,
+           hits, lookups > 0 ? 100.0 * hits / lookups : 0.0);
+    for (size_t i = 0; i < NUM_LATENCY_BUCKETS; i++) {
+        uint64_t count = stats.lookup_latencies[i];
+        if (count > 0) {
+            printf("  %" PRIu64 "-%" PRIu64 " ns: %" PRIu64 "\n", UINT64_C(1) << i,
+                   (UINT64_C(1) << (i + 1)) - 1, count);
+        }
+    }
+
+    printf("processes: %" PRIu64 " forks, %" PRIu64 " execs\n", stats_get(STAT_FORKS),
+           stats_get(STAT_EXECS));
+    printf("allocations: %" PRIu64 " total, %" PRIu64 " in the last line, %" PRIu64
+           " at most in a line, over %" PRIu64 " lines\n",
+           stats_get_allocations(), stats.last_line_allocations, stats.max_line_allocations,
+           stats.lines);
+    printf("time: scan %.6f s, parse %.6f s, execute %.6f s\n", to_seconds(STAT_SCAN_NS),
+           to_seconds(STAT_PARSE_NS), to_seconds(STAT_EXECUTE_NS));
+}
+
+static void print_json(const Sizes *sizes) {
+    printf("{\"trie\":{\"nodes\":%zu,\"bytes\":%zu},", sizes->trie_nodes, sizes->trie_bytes);
+    if (sizes->has_index) {
+        printf("\"executable_index\":{\"names\":%zu,\"age_seconds\":%.3f},",
+               sizes->index_names, sizes->index_age);
+    } else {
+        printf("\"executable_index\":null,");
+    }
+    printf("\"history\":{\"entries\":%zu,\"bytes\":%zu},", sizes->history_entries,
+           sizes->history_bytes);
+
+    printf("\"path_lookups\":{\"calls\":%" PRIu64 ",\"hits\":%" PRIu64 ",\"latency_ns\":[",
+           stats_get(STAT_LOOKUPS), stats_get(STAT_LOOKUP_HITS));
+    bool first = true;
+    for (size_t i = 0; i < NUM_LATENCY_BUCKETS; i++) {
+        uint64_t count = stats.lookup_latencies[i];
+        if (count > 0) {
+            printf("%s{\"min\":%" PRIu64 ",\"max\":%" PRIu64 ",\"count\":%" PRIu64 "}",
+                   first ? "" : ",", UINT64_C(1) << i, (UINT64_C(1) << (i + 1)) - 1, count);
+            first = false;
+        }
+    }
+    printf("]},");
+
+    printf("\"forks\":%" PRIu64 ",\"execs\":%" PRIu64 ",", stats_get(STAT_FORKS),
+           stats_get(STAT_EXECS));
+    printf("\"allocations\":{\"total\":%" PRIu64 ",\"last_line\":%" PRIu64
+           ",\"max_line\":%" PRIu64 ",\"lines\":%" PRIu64 "},",
+           stats_get_allocations(), stats.last_line_allocations, stats.max_line_allocations,
+           stats.lines);
+    printf("\"time_ns\":{\"scan\":%" PRIu64 ",\"parse\":%" PRIu64 ",\"execute\":%" PRIu64
+           "}}\n",
+           stats_get(STAT_SCAN_NS), stats_get(STAT_PARSE_NS), stats_get(STAT_EXECUTE_NS));
+}
+
+int cmd_shellstat(const PtrArray *arguments) {
+    bool json = false;
+    size_t num_args = ptr_array_get_size(arguments);
+    for (size_t i = 1; i < num_args; i++) {
+        const char *arg = ptr_array_get_const(arguments, i);
+        if (strcmp(arg, "-j") == 0) {
+            json = true;
+        } else {
+            fprintf(stderr, "shellstat: %s: invalid option\n", arg);
+            fprintf(stderr, "shellstat: usage: shellstat [-j]\n");
+            return 2;
+        }
+    }
+
+    Sizes sizes;
+    get_sizes(&sizes);
+    if (json) {
+        print_json(&sizes);
+    } else {
+        print_human(&sizes);
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef CODECRAFTERS_SHELL_STATS_H_INCLUDED
+#define CODECRAFTERS_SHELL_STATS_H_INCLUDED
+
+#include <stdint.h>
+
+#include "ptr_array.h"
+
+// Counters that the shellstat builtin reports.
+typedef enum {
+    // Processes started, counted in memory shared with the children of the shell, since pipeline
+    // stages fork and exec there.
+    STAT_FORKS,
+    STAT_EXECS,
+    STAT_NUM_SHARED,
+    // The rest count what the main thread of the shell process does. Calls of find_executable(),
+    // and the ones that a remembered path answered.
+    STAT_LOOKUPS = STAT_NUM_SHARED,
+    STAT_LOOKUP_HITS,
+    // Time spent on the lines that the shell read, in nanoseconds.
+    STAT_SCAN_NS,
+    STAT_PARSE_NS,
+    STAT_EXECUTE_NS,
+    STAT_NUM_COUNTERS,
+} StatCounter;
+
+// Maps the shared counters into memory that forked children share. Counting before this only counts
+// in the calling process.
+void stats_init(void);
+
+// Adds to a counter.
+void stats_add(StatCounter counter, uint64_t n);
+
+// Returns a monotonic time in nanoseconds for measuring durations.
+uint64_t stats_now(void);
+
+// Counts a call of find_executable() that started at start_ns, and records how long it took.
+void stats_lookup_done(uint64_t start_ns);
+
+// Counts an allocation made by the calling thread, at the cost of an increment of a thread-local
+// variable.
+void stats_count_allocation(void);
+
+// Adds the allocations of the calling thread to the total. Threads other than the main one call
+// this before they exit.
+void stats_thread_done(void);
+
+// Returns the number of allocations made by the main thread and by threads that finished.
+uint64_t stats_get_allocations(void);
+
+// Records the allocations made while a line ran, given the count when it was read.
+void stats_line_done(uint64_t allocations_at_start);
+
+// Returns the current value of a counter.
+uint64_t stats_get(StatCounter counter);
+
+// Reports the counters and the sizes of the shell's caches (the shellstat builtin). With -j, the
+// report is a JSON object.
+int cmd_shellstat(const PtrArray *arguments);
+
+#endif
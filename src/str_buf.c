@@ -0,0 +1,75 @@
+#include "str_buf.h"
+#include "xmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct StrBuf {
+    char *chars;
+    size_t size;
+    size_t capacity;
+};
+
+StrBuf *str_buf_create(void) {
+    StrBuf *buf = xmalloc(sizeof(StrBuf));
+    buf->capacity = 16;
+    buf->chars = xmalloc(buf->capacity);
+    buf->chars[0] = '\0';
+    buf->size = 0;
+    return buf;
+}
+
+void str_buf_destroy(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    StrBuf *buf = ptr;
+    free(buf->chars);
+    free(buf);
+}
+
+char *str_buf_release(StrBuf *buf) {
+    char *chars = buf->chars;
+    free(buf);
+    return chars;
+}
+
+size_t str_buf_get_size(const StrBuf *buf) {
+    return buf->size;
+}
+
+const char *str_buf_get(const StrBuf *buf) {
+    return buf->chars;
+}
+
+static void reserve(StrBuf *buf, size_t n) {
+    if (buf->size + n < buf->capacity) {
+        return;
+    }
+    while (buf->size + n >= buf->capacity) {
+        buf->capacity *= 2;
+    }
+    buf->chars = xrealloc(buf->chars, buf->capacity);
+}
+
+void str_buf_append_char(StrBuf *buf, char c) {
+    reserve(buf, 1);
+    buf->chars[buf->size++] = c;
+    buf->chars[buf->size] = '\0';
+}
+
+void str_buf_append_n(StrBuf *buf, const char *s, size_t n) {
+    reserve(buf, n);
+    memcpy(buf->chars + buf->size, s, n);
+    buf->size += n;
+    buf->chars[buf->size] = '\0';
+}
+
+void str_buf_append(StrBuf *buf, const char *s) {
+    str_buf_append_n(buf, s, strlen(s));
+}
+
+void str_buf_clear(StrBuf *buf) {
+    buf->size = 0;
+    buf->chars[0] = '\0';
+}
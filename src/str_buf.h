@@ -0,0 +1,35 @@
+#ifndef CODECRAFTERS_SHELL_STR_BUF_H_INCLUDED
+#define CODECRAFTERS_SHELL_STR_BUF_H_INCLUDED
+
+#include <stddef.h>
+
+typedef struct StrBuf StrBuf;
+
+// Allocates memory for an empty string buffer.
+StrBuf *str_buf_create(void);
+
+// Deallocates memory for a string buffer.
+void str_buf_destroy(void *buf);
+
+// Deallocates memory for a string buffer, returning its contents as a dynamically allocated string.
+char *str_buf_release(StrBuf *buf);
+
+// Gets the length of the string in a buffer.
+size_t str_buf_get_size(const StrBuf *buf);
+
+// Returns the null-terminated string in a buffer.
+const char *str_buf_get(const StrBuf *buf);
+
+// Appends a character to the end of a buffer.
+void str_buf_append_char(StrBuf *buf, char c);
+
+// Appends n bytes to the end of a buffer.
+void str_buf_append_n(StrBuf *buf, const char *s, size_t n);
+
+// Appends a string to the end of a buffer.
+void str_buf_append(StrBuf *buf, const char *s);
+
+// Empties a buffer without releasing its memory.
+void str_buf_clear(StrBuf *buf);
+
+#endif
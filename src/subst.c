@@ -0,0 +1,217 @@
+#include "subst.h"
+#include "cmd.h"
+#include "jobs.h"
+#include "parse.h"
+#include "ptr_array.h"
+#include "scan.h"
+#include "str_buf.h"
+#include "token.h"
+#include "xmalloc.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The pipe that carries the output of a forked substitution is enlarged to this size when allowed,
+// so that the command seldom blocks on a full pipe while the shell is reading.
+#define PIPE_SIZE (1024 * 1024)
+
+#define READ_SIZE (64 * 1024)
+
+// The shell's ends of process substitution pipes are moved to this descriptor or above, out of the
+// way of redirections of the low-numbered ones.
+#define PROCESS_SUBSTITUTION_FD_MIN 10
+
+typedef struct {
+    int fd;
+    Job *job;
+} ProcessSubstitution;
+
+// The process substitutions of the commands being executed, innermost last.
+static PtrArray *process_substitutions = NULL;
+
+static PtrArray *parse_text(const char *text) {
+    PtrArray *tokens = scan(text);
+    if (tokens == NULL) {
+        const char *error = scan_get_error();
+        fprintf(stderr, "%s\n", error != NULL ? error : "unexpected end of file in here-document");
+        return NULL;
+    }
+    PtrArray *pipelines = parse(tokens);
+    ptr_array_destroy(tokens, token_destroy);
+    return pipelines;
+}
+
+static bool is_capturable(const PtrArray *pipelines) {
+    size_t num_pipelines = ptr_array_get_size(pipelines);
+    for (size_t i = 0; i < num_pipelines; i++) {
+        if (!pipeline_is_capturable(ptr_array_get_const(pipelines, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs builtins in the shell itself with the stdout stream writing to a growable buffer.
+static char *capture_in_process(PtrArray *pipelines) {
+    char *output = NULL;
+    size_t size = 0;
+    FILE *stream = open_memstream(&output, &size);
+    if (stream == NULL) {
+        err(EXIT_FAILURE, "open_memstream");
+    }
+
+    fflush(stdout);
+    FILE *saved_stdout = stdout;
+    stdout = stream;
+    execute_pipelines(pipelines);
+    stdout = saved_stdout;
+    fclose(stream);
+
+    set_substitution_status(get_last_status());
+    return output;
+}
+
+// Runs the commands in one child of the shell and reads their output through a pipe.
+static char *capture_in_child(PtrArray *pipelines, const char *text) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe");
+        set_substitution_status(1);
+        return xstrdup("");
+    }
+    fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+    Job *job = job_create(text, false);
+    if (job_fork(job) == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        if (fds[0] != STDOUT_FILENO) {
+            close(fds[0]);
+        }
+        if (fds[1] != STDOUT_FILENO) {
+            close(fds[1]);
+        }
+        execute_pipelines_in_child(pipelines);
+    }
+    close(fds[1]);
+
+    StrBuf *output = str_buf_create();
+    char *buf = xmalloc(READ_SIZE);
+    for (;;) {
+        ssize_t num_read = read(fds[0], buf, READ_SIZE);
+        if (num_read < 0 && errno == EINTR) {
+            continue;
+        } else if (num_read <= 0) {
+            break;
+        }
+        str_buf_append_n(output, buf, num_read);
+    }
+    free(buf);
+    close(fds[0]);
+
+    int status;
+    job_wait(job, &status);
+    set_substitution_status(status);
+    return str_buf_release(output);
+}
+
+char *command_substitution(const char *text) {
+    PtrArray *pipelines = parse_text(text);
+    if (pipelines == NULL) {
+        set_substitution_status(2);
+        return xstrdup("");
+    }
+
+    char *output = is_capturable(pipelines) ? capture_in_process(pipelines)
+                                            : capture_in_child(pipelines, text);
+    ptr_array_destroy(pipelines, pipeline_destroy);
+
+    size_t length = strlen(output);
+    while (length > 0 && output[length - 1] == '\n') {
+        output[--length] = '\0';
+    }
+    return output;
+}
+
+char *process_substitution(const char *text, bool input) {
+    PtrArray *pipelines = parse_text(text);
+    if (pipelines == NULL) {
+        return NULL;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe");
+        ptr_array_destroy(pipelines, pipeline_destroy);
+        return NULL;
+    }
+    fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+    int shell_end = input ? fds[0] : fds[1];
+    int child_end = input ? fds[1] : fds[0];
+    int child_fd = input ? STDOUT_FILENO : STDIN_FILENO;
+
+    if (process_substitutions == NULL) {
+        process_substitutions = ptr_array_create();
+    }
+    Job *job = job_create(text, true);
+    if (job_fork(job) == 0) {
+        // The pipes of other substitutions would keep their commands from seeing the end of them.
+        size_t num_substitutions = ptr_array_get_size(process_substitutions);
+        for (size_t i = 0; i < num_substitutions; i++) {
+            const ProcessSubstitution *substitution =
+                ptr_array_get_const(process_substitutions, i);
+            close(substitution->fd);
+        }
+        dup2(child_end, child_fd);
+        if (child_end != child_fd) {
+            close(child_end);
+        }
+        if (shell_end != child_fd) {
+            close(shell_end);
+        }
+        execute_pipelines_in_child(pipelines);
+    }
+    close(child_end);
+    ptr_array_destroy(pipelines, pipeline_destroy);
+
+    // The command that gets the path inherits the descriptor.
+    int fd = fcntl(shell_end, F_DUPFD, PROCESS_SUBSTITUTION_FD_MIN);
+    if (fd < 0) {
+        fd = shell_end;
+        fcntl(fd, F_SETFD, 0);
+    } else {
+        close(shell_end);
+    }
+
+    ProcessSubstitution *substitution = xmalloc(sizeof(ProcessSubstitution));
+    substitution->fd = fd;
+    substitution->job = job;
+    ptr_array_append(process_substitutions, substitution);
+
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    return xstrdup(path);
+}
+
+size_t get_num_process_substitutions(void) {
+    return process_substitutions != NULL ? ptr_array_get_size(process_substitutions) : 0;
+}
+
+void finish_process_substitutions(size_t first) {
+    size_t num_substitutions = get_num_process_substitutions();
+    // Closing the pipes first lets readers see the end of their input and writers stop.
+    for (size_t i = first; i < num_substitutions; i++) {
+        const ProcessSubstitution *substitution = ptr_array_get_const(process_substitutions, i);
+        close(substitution->fd);
+    }
+    while (get_num_process_substitutions() > first) {
+        ProcessSubstitution *substitution = ptr_array_pop(process_substitutions);
+        int status;
+        job_wait(substitution->job, &status);
+        free(substitution);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef CODECRAFTERS_SHELL_SUBST_H_INCLUDED
+#define CODECRAFTERS_SHELL_SUBST_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Runs the commands in text and returns their output without trailing newlines as a dynamically
+// allocated string. Their exit status becomes the last exit status.
+char *command_substitution(const char *text);
+
+// Starts the commands in text with their standard output, for <(text), or their standard input, for
+// >(text), connected to a pipe. Returns the /dev/fd path of the shell's end of the pipe as a
+// dynamically allocated string, or NULL after reporting an error.
+char *process_substitution(const char *text, bool input);
+
+// Returns the number of process substitutions that are still open, so that a command can finish
+// the ones started after it.
+size_t get_num_process_substitutions(void);
+
+// Closes the pipes of the process substitutions started after the first given number, and waits for
+// their commands.
+void finish_process_substitutions(size_t first);
+
+#endif
@@ -0,0 +1,298 @@
+#include "test.h"
+#include "ptr_array.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static struct {
+    const PtrArray *arguments;
+    size_t current;
+    size_t end;
+    bool failed;
+} tester;
+
+static const char *arg(size_t index) {
+    return ptr_array_get_const(tester.arguments, index);
+}
+
+static bool error(const char *message, const char *operand) {
+    if (!tester.failed) {
+        if (operand != NULL) {
+            fprintf(stderr, "test: %s: %s\n", operand, message);
+        } else {
+            fprintf(stderr, "test: %s\n", message);
+        }
+    }
+    tester.failed = true;
+    return false;
+}
+
+static bool is_unary_op(const char *op) {
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghLnprsStuwxz", op[1]);
+}
+
+static bool is_binary_op(const char *op) {
+    static const char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-gt", "-ge", "-lt", "-le",
+                                "-nt", "-ot", "-ef"};
+    for (size_t i = 0; i < sizeof(ops) / sizeof(const char *); i++) {
+        if (strcmp(op, ops[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool to_integer(const char *str, long long *value) {
+    errno = 0;
+    char *end;
+    *value = strtoll(str, &end, 10);
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (end == str || *end != '\0' || errno != 0) {
+        return error("integer expression expected", str);
+    }
+    return true;
+}
+
+static bool unary(char op, const char *operand) {
+    if (op == 'n') {
+        return operand[0] != '\0';
+    } else if (op == 'z') {
+        return operand[0] == '\0';
+    } else if (op == 't') {
+        long long fd;
+        return to_integer(operand, &fd) && fd >= 0 && fd <= INT32_MAX && isatty((int)fd);
+    }
+
+    struct stat st;
+    int result = op == 'h' || op == 'L' ? lstat(operand, &st) : stat(operand, &st);
+    if (result < 0) {
+        return false;
+    }
+
+    switch (op) {
+        case 'b':
+            return S_ISBLK(st.st_mode);
+        case 'c':
+            return S_ISCHR(st.st_mode);
+        case 'd':
+            return S_ISDIR(st.st_mode);
+        case 'e':
+            return true;
+        case 'f':
+            return S_ISREG(st.st_mode);
+        case 'g':
+            return st.st_mode & S_ISGID;
+        case 'h':
+        case 'L':
+            return S_ISLNK(st.st_mode);
+        case 'p':
+            return S_ISFIFO(st.st_mode);
+        case 'r':
+            return access(operand, R_OK) == 0;
+        case 's':
+            return st.st_size > 0;
+        case 'S':
+            return S_ISSOCK(st.st_mode);
+        case 'u':
+            return st.st_mode & S_ISUID;
+        case 'w':
+            return access(operand, W_OK) == 0;
+        case 'x':
+            return access(operand, X_OK) == 0;
+        default:
+            return false;
+    }
+}
+
+static bool compare_mtimes(const char *left, const char *right, bool newer) {
+    struct stat lst, rst;
+    bool has_left = stat(left, &lst) == 0;
+    bool has_right = stat(right, &rst) == 0;
+    if (!has_left || !has_right) {
+        return newer ? has_left : has_right;
+    }
+    if (lst.st_mtim.tv_sec != rst.st_mtim.tv_sec) {
+        return newer == (lst.st_mtim.tv_sec > rst.st_mtim.tv_sec);
+    }
+    if (lst.st_mtim.tv_nsec == rst.st_mtim.tv_nsec) {
+        return false;
+    }
+    return newer == (lst.st_mtim.tv_nsec > rst.st_mtim.tv_nsec);
+}
+
+static bool binary(const char *left, const char *op, const char *right) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        return strcmp(left, right) == 0;
+    } else if (strcmp(op, "!=") == 0) {
+        return strcmp(left, right) != 0;
+    } else if (strcmp(op, "<") == 0) {
+        return strcmp(left, right) < 0;
+    } else if (strcmp(op, ">") == 0) {
+        return strcmp(left, right) > 0;
+    } else if (strcmp(op, "-nt") == 0) {
+        return compare_mtimes(left, right, true);
+    } else if (strcmp(op, "-ot") == 0) {
+        return compare_mtimes(left, right, false);
+    } else if (strcmp(op, "-ef") == 0) {
+        struct stat lst, rst;
+        return stat(left, &lst) == 0 && stat(right, &rst) == 0 && lst.st_dev == rst.st_dev &&
+               lst.st_ino == rst.st_ino;
+    }
+
+    long long l, r;
+    if (!to_integer(left, &l) || !to_integer(right, &r)) {
+        return false;
+    }
+    if (strcmp(op, "-eq") == 0) {
+        return l == r;
+    } else if (strcmp(op, "-ne") == 0) {
+        return l != r;
+    } else if (strcmp(op, "-gt") == 0) {
+        return l > r;
+    } else if (strcmp(op, "-ge") == 0) {
+        return l >= r;
+    } else if (strcmp(op, "-lt") == 0) {
+        return l < r;
+    } else {
+        return l <= r;
+    }
+}
+
+static bool has_args(size_t n) {
+    return tester.current + n <= tester.end;
+}
+
+static const char *advance(void) {
+    return arg(tester.current++);
+}
+
+static bool or_expr(void);
+
+static bool primary(void) {
+    if (!has_args(1)) {
+        return error("argument expected", NULL);
+    }
+
+    if (has_args(3) && is_binary_op(arg(tester.current + 1))) {
+        const char *left = advance();
+        const char *op = advance();
+        return binary(left, op, advance());
+    }
+
+    if (strcmp(arg(tester.current), "(") == 0) {
+        advance();
+        bool result = or_expr();
+        if (!has_args(1) || strcmp(advance(), ")") != 0) {
+            return error("missing ')'", NULL);
+        }
+        return result;
+    }
+
+    if (has_args(2) && is_unary_op(arg(tester.current))) {
+        const char *op = advance();
+        return unary(op[1], advance());
+    }
+
+    return advance()[0] != '\0';
+}
+
+static bool not_expr(void) {
+    if (has_args(2) && strcmp(arg(tester.current), "!") == 0) {
+        advance();
+        return !not_expr();
+    }
+    return primary();
+}
+
+static bool and_expr(void) {
+    bool result = not_expr();
+    while (has_args(1) && strcmp(arg(tester.current), "-a") == 0) {
+        advance();
+        // Both operands are evaluated so that errors are reported regardless of the result.
+        bool right = not_expr();
+        result = result && right;
+    }
+    return result;
+}
+
+static bool or_expr(void) {
+    bool result = and_expr();
+    while (has_args(1) && strcmp(arg(tester.current), "-o") == 0) {
+        advance();
+        bool right = and_expr();
+        result = result || right;
+    }
+    return result;
+}
+
+// Evaluates the arguments in [start, end) following the POSIX rules that decide the meaning of an
+// expression from its number of arguments, falling back to precedence parsing beyond four.
+static bool evaluate(size_t start, size_t end) {
+    size_t n = end - start;
+    if (n == 0) {
+        return false;
+    } else if (n == 1) {
+        return arg(start)[0] != '\0';
+    } else if (n == 2) {
+        if (strcmp(arg(start), "!") == 0) {
+            return arg(start + 1)[0] == '\0';
+        }
+        if (is_unary_op(arg(start))) {
+            return unary(arg(start)[1], arg(start + 1));
+        }
+        return error("unary operator expected", arg(start));
+    } else if (n == 3) {
+        if (is_binary_op(arg(start + 1))) {
+            return binary(arg(start), arg(start + 1), arg(start + 2));
+        }
+        if (strcmp(arg(start), "!") == 0) {
+            return !evaluate(start + 1, end);
+        }
+        if (strcmp(arg(start), "(") == 0 && strcmp(arg(start + 2), ")") == 0) {
+            return arg(start + 1)[0] != '\0';
+        }
+    } else if (n == 4) {
+        if (strcmp(arg(start), "!") == 0) {
+            return !evaluate(start + 1, end);
+        }
+        if (strcmp(arg(start), "(") == 0 && strcmp(arg(start + 3), ")") == 0) {
+            return evaluate(start + 1, end - 1);
+        }
+    }
+
+    tester.current = start;
+    bool result = or_expr();
+    if (has_args(1)) {
+        return error("too many arguments", NULL);
+    }
+    return result;
+}
+
+int cmd_test(const PtrArray *arguments) {
+    size_t end = ptr_array_get_size(arguments);
+    if (strcmp(ptr_array_get_const(arguments, 0), "[") == 0) {
+        if (end < 2 || strcmp(ptr_array_get_const(arguments, end - 1), "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        end--;
+    }
+
+    tester.arguments = arguments;
+    tester.end = end;
+    tester.failed = false;
+
+    bool result = evaluate(1, end);
+    if (tester.failed) {
+        return 2;
+    }
+    return result ? 0 : 1;
+}
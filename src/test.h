@@ -0,0 +1,10 @@
+#ifndef CODECRAFTERS_SHELL_TEST_H_INCLUDED
+#define CODECRAFTERS_SHELL_TEST_H_INCLUDED
+
+#include "ptr_array.h"
+
+// Evaluates a conditional expression (the test and [ builtins). Returns 0 if the expression is
+// true, 1 if it is false, and 2 on error.
+int cmd_test(const PtrArray *arguments);
+
+#endif
@@ -3,10 +3,26 @@
 
 typedef enum {
     TOKEN_WORD,
+    TOKEN_ARITH,
     TOKEN_OR,
+    TOKEN_AND,
+    TOKEN_AND_IF,
+    TOKEN_OR_IF,
+    TOKEN_SEMI,
+    TOKEN_NEWLINE,
     TOKEN_IO_NUMBER,
+    TOKEN_LESS,
+    TOKEN_DLESS,
+    TOKEN_DLESSDASH,
+    TOKEN_TLESS,
+    TOKEN_LESSAND,
     TOKEN_GREAT,
     TOKEN_DGREAT,
+    TOKEN_GREATAND,
+    // The delimiter following << or <<-, whose lexeme is replaced by the body of the here-document
+    // once it has been read. The body is not expanded if any part of the delimiter was quoted.
+    TOKEN_HEREDOC,
+    TOKEN_HEREDOC_QUOTED,
     TOKEN_EOF,
 } TokenType;
 
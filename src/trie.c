@@ -34,11 +34,13 @@ static void trie_node_destroy(TrieNode *node) {
 
 struct Trie {
     TrieNode *root;
+    size_t num_nodes;
 };
 
 Trie *trie_create(void) {
     Trie *trie = xmalloc(sizeof(Trie));
     trie->root = trie_node_create();
+    trie->num_nodes = 1;
     return trie;
 }
 
@@ -57,6 +59,7 @@ void trie_insert(Trie *trie, const char *str) {
         char c = *p;
         if (current->children[c] == NULL) {
             current->children[c] = trie_node_create();
+            trie->num_nodes++;
         }
         current = current->children[c];
     }
@@ -75,6 +78,11 @@ static const TrieNode *locate(const Trie *trie, const char *str) {
     return current;
 }
 
+void trie_get_size(const Trie *trie, size_t *num_nodes, size_t *num_bytes) {
+    *num_nodes = trie->num_nodes;
+    *num_bytes = sizeof(Trie) + trie->num_nodes * sizeof(TrieNode);
+}
+
 bool trie_search(const Trie *trie, const char *str) {
     const TrieNode *node = locate(trie, str);
     return node != NULL && node->has_value;
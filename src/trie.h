@@ -14,6 +14,9 @@ void trie_destroy(void *trie);
 // Inserts a string into a trie.
 void trie_insert(Trie *trie, const char *str);
 
+// Gets the number of nodes in a trie and the memory they take, not counting allocator overhead.
+void trie_get_size(const Trie *trie, size_t *num_nodes, size_t *num_bytes);
+
 // Searches for a complete string in the trie.
 bool trie_search(const Trie *trie, const char *str);
 
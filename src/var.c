@@ -0,0 +1,413 @@
+#include "var.h"
+#include "misc.h"
+#include "ptr_array.h"
+#include "xmalloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A variable is kept as a single NAME=value string, which the environment of executed commands
+// points to directly. A variable can be exported or readonly before it has a value, in which case
+// the string holds only its name. An array also keeps its elements, the first of which is its value
+// as a plain variable.
+typedef struct {
+    char *string;
+    PtrArray *elements;
+    size_t name_length;
+    size_t hash;
+    bool has_value;
+    bool exported;
+    bool readonly;
+} Var;
+
+// Variables are looked up by name in an open-addressing table. The environment is rebuilt only when
+// an exported variable changes, and environ points to it, so that getenv() in the shell itself, as
+// by readline for TERM and COLUMNS, sees the same values as executed commands.
+static struct {
+    Var **slots;
+    size_t num_slots;
+    size_t num_vars;
+    char **envp;
+    // The bytes that envp takes when passed to execve(), counting the strings and the pointers.
+    size_t envp_size;
+    bool envp_stale;
+    unsigned long path_generation;
+} vars = {.envp_stale = true};
+
+// Hashes a name with FNV-1a.
+static size_t hash_name(const char *name, size_t length) {
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211u;
+    }
+    return (size_t)hash;
+}
+
+static bool has_name(const Var *var, const char *name, size_t length, size_t hash) {
+    return var->hash == hash && var->name_length == length &&
+           memcmp(var->string, name, length) == 0;
+}
+
+static size_t find_slot(const char *name, size_t length, size_t hash) {
+    size_t i = hash & (vars.num_slots - 1);
+    while (vars.slots[i] != NULL && !has_name(vars.slots[i], name, length, hash)) {
+        i = (i + 1) & (vars.num_slots - 1);
+    }
+    return i;
+}
+
+static Var *var_find(const char *name, size_t length) {
+    if (vars.num_slots == 0) {
+        return NULL;
+    }
+    return vars.slots[find_slot(name, length, hash_name(name, length))];
+}
+
+static void grow_slots(void) {
+    Var **old_slots = vars.slots;
+    size_t old_num_slots = vars.num_slots;
+
+    vars.num_slots = old_num_slots == 0 ? 256 : old_num_slots * 2;
+    vars.slots = xmalloc(sizeof(Var *) * vars.num_slots);
+    for (size_t i = 0; i < vars.num_slots; i++) {
+        vars.slots[i] = NULL;
+    }
+
+    for (size_t i = 0; i < old_num_slots; i++) {
+        const Var *var = old_slots[i];
+        if (var != NULL) {
+            vars.slots[find_slot(var->string, var->name_length, var->hash)] = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+// Finds a variable, creating it without a value if it does not exist.
+static Var *var_find_or_create(const char *name, size_t length) {
+    if ((vars.num_vars + 1) * 4 > vars.num_slots * 3) {
+        grow_slots();
+    }
+
+    size_t hash = hash_name(name, length);
+    size_t i = find_slot(name, length, hash);
+    if (vars.slots[i] == NULL) {
+        Var *var = xmalloc(sizeof(Var));
+        var->string = xstrndup(name, length);
+        var->elements = NULL;
+        var->name_length = length;
+        var->hash = hash;
+        var->has_value = false;
+        var->exported = false;
+        var->readonly = false;
+        vars.slots[i] = var;
+        vars.num_vars++;
+    }
+    return vars.slots[i];
+}
+
+static void var_remove(const Var *var) {
+    size_t mask = vars.num_slots - 1;
+    size_t i = find_slot(var->string, var->name_length, var->hash);
+    vars.slots[i] = NULL;
+    vars.num_vars--;
+
+    // Shift later entries of the probe sequence back so that lookups never stop at the hole.
+    for (size_t j = (i + 1) & mask; vars.slots[j] != NULL; j = (j + 1) & mask) {
+        size_t k = vars.slots[j]->hash & mask;
+        bool in_place = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        if (!in_place) {
+            vars.slots[i] = vars.slots[j];
+            vars.slots[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+static void rebuild_envp(void) {
+    size_t num_exported = 0;
+    for (size_t i = 0; i < vars.num_slots; i++) {
+        const Var *var = vars.slots[i];
+        if (var != NULL && var->exported && var->has_value && var->elements == NULL) {
+            num_exported++;
+        }
+    }
+
+    vars.envp = xrealloc(vars.envp, sizeof(char *) * (num_exported + 1));
+    vars.envp_size = sizeof(char *);
+    size_t n = 0;
+    for (size_t i = 0; i < vars.num_slots; i++) {
+        Var *var = vars.slots[i];
+        if (var != NULL && var->exported && var->has_value && var->elements == NULL) {
+            vars.envp[n++] = var->string;
+            vars.envp_size += strlen(var->string) + 1 + sizeof(char *);
+        }
+    }
+    vars.envp[n] = NULL;
+    vars.envp_stale = false;
+    environ = vars.envp;
+}
+
+// Called after a variable changes but before its old string is freed, which environ may still
+// point to until the environment is rebuilt.
+static void var_changed(const Var *var) {
+    if (var->exported) {
+        rebuild_envp();
+    }
+    if (var->name_length == 4 && memcmp(var->string, "PATH", 4) == 0) {
+        vars.path_generation++;
+    }
+}
+
+static bool check_writable(const Var *var) {
+    if (var->readonly) {
+        fprintf(stderr, "%.*s: readonly variable\n", (int)var->name_length, var->string);
+        return false;
+    }
+    return true;
+}
+
+static void set_value(Var *var, const char *value) {
+    size_t value_length = strlen(value);
+    char *string = xmalloc(var->name_length + value_length + 2);
+    memcpy(string, var->string, var->name_length);
+    string[var->name_length] = '=';
+    memcpy(string + var->name_length + 1, value, value_length + 1);
+    char *old_string = var->string;
+    var->string = string;
+    var->has_value = true;
+    if (var->elements != NULL && ptr_array_is_empty(var->elements)) {
+        ptr_array_append(var->elements, xstrdup(value));
+    } else if (var->elements != NULL) {
+        free(ptr_array_get(var->elements, 0));
+        ptr_array_set(var->elements, 0, xstrdup(value));
+    }
+    var_changed(var);
+    free(old_string);
+}
+
+static void set_exported(Var *var) {
+    if (!var->exported) {
+        var->exported = true;
+        var_changed(var);
+    }
+}
+
+void vars_init(void) {
+    for (char **env = environ; *env != NULL; env++) {
+        if (strchr(*env, '=') != NULL) {
+            var_assign(*env, true);
+        }
+    }
+}
+
+const char *var_get(const char *name) {
+    const Var *var = var_find(name, strlen(name));
+    if (var == NULL || !var->has_value) {
+        return NULL;
+    }
+    return var->string + var->name_length + 1;
+}
+
+bool var_set(const char *name, const char *value) {
+    Var *var = var_find_or_create(name, strlen(name));
+    if (!check_writable(var)) {
+        return false;
+    }
+    set_value(var, value);
+    return true;
+}
+
+bool var_set_array(const char *name, PtrArray *elements) {
+    Var *var = var_find_or_create(name, strlen(name));
+    if (!check_writable(var)) {
+        ptr_array_destroy(elements, free);
+        return false;
+    }
+    if (var->elements != NULL) {
+        ptr_array_destroy(var->elements, free);
+        var->elements = NULL;
+    }
+    set_value(var, ptr_array_is_empty(elements) ? "" : ptr_array_get_const(elements, 0));
+    var->elements = elements;
+    return true;
+}
+
+const PtrArray *var_get_array(const char *name) {
+    const Var *var = var_find(name, strlen(name));
+    return var != NULL ? var->elements : NULL;
+}
+
+bool var_assign(const char *assignment, bool export) {
+    const char *equals = strchr(assignment, '=');
+    Var *var = var_find_or_create(assignment, equals - assignment);
+    if (!check_writable(var)) {
+        return false;
+    }
+    set_value(var, equals + 1);
+    if (export) {
+        set_exported(var);
+    }
+    return true;
+}
+
+bool var_unset(const char *name) {
+    Var *var = var_find(name, strlen(name));
+    if (var == NULL) {
+        return true;
+    }
+    if (var->readonly) {
+        fprintf(stderr, "%s: cannot unset: readonly variable\n", name);
+        return false;
+    }
+    var_remove(var);
+    var_changed(var);
+    if (var->elements != NULL) {
+        ptr_array_destroy(var->elements, free);
+    }
+    free(var->string);
+    free(var);
+    return true;
+}
+
+char **var_get_envp(void) {
+    if (vars.envp_stale) {
+        rebuild_envp();
+    }
+    return vars.envp;
+}
+
+size_t var_get_envp_size(void) {
+    var_get_envp();
+    return vars.envp_size;
+}
+
+unsigned long var_get_path_generation(void) {
+    return vars.path_generation;
+}
+
+static int compare_vars(const void *a, const void *b) {
+    const Var *var_a = *(const Var *const *)a;
+    const Var *var_b = *(const Var *const *)b;
+    size_t length =
+        var_a->name_length < var_b->name_length ? var_a->name_length : var_b->name_length;
+    int result = memcmp(var_a->string, var_b->string, length);
+    if (result != 0) {
+        return result;
+    }
+    return (var_a->name_length > var_b->name_length) - (var_a->name_length < var_b->name_length);
+}
+
+// Lists the exported or readonly variables, sorted by name, in a form that can be read back.
+static void print_vars(const char *builtin, bool readonly) {
+    Var **listed = xmalloc(sizeof(Var *) * (vars.num_vars + 1));
+    size_t num_listed = 0;
+    for (size_t i = 0; i < vars.num_slots; i++) {
+        Var *var = vars.slots[i];
+        if (var != NULL && (readonly ? var->readonly : var->exported)) {
+            listed[num_listed++] = var;
+        }
+    }
+    qsort(listed, num_listed, sizeof(Var *), compare_vars);
+
+    for (size_t i = 0; i < num_listed; i++) {
+        const Var *var = listed[i];
+        printf("%s %.*s", builtin, (int)var->name_length, var->string);
+        if (var->has_value) {
+            printf("=\"");
+            for (const char *p = var->string + var->name_length + 1; *p != '\0'; p++) {
+                if (strchr("\"\\$`", *p) != NULL) {
+                    putchar('\\');
+                }
+                putchar(*p);
+            }
+            putchar('"');
+        }
+        putchar('\n');
+    }
+    free(listed);
+}
+
+// Gives variables an attribute, assigning the ones written as NAME=value.
+static int declare(const PtrArray *arguments, const char *builtin, bool readonly) {
+    size_t num_args = ptr_array_get_size(arguments);
+    size_t first_name = 1;
+    if (num_args > 1 && strcmp(ptr_array_get_const(arguments, 1), "-p") == 0) {
+        first_name = 2;
+    } else if (num_args > 1 && strcmp(ptr_array_get_const(arguments, 1), "--") == 0) {
+        first_name = 2;
+    }
+    if (first_name == num_args) {
+        print_vars(builtin, readonly);
+        return 0;
+    }
+
+    int status = 0;
+    for (size_t i = first_name; i < num_args; i++) {
+        const char *arg = ptr_array_get_const(arguments, i);
+        const char *equals = strchr(arg, '=');
+        char *name = equals != NULL ? xstrndup(arg, equals - arg) : xstrdup(arg);
+        if (!is_valid_name(name)) {
+            fprintf(stderr, "%s: `%s': not a valid identifier\n", builtin, arg);
+            status = 1;
+            free(name);
+            continue;
+        }
+
+        Var *var = var_find_or_create(name, strlen(name));
+        free(name);
+        if (equals != NULL) {
+            if (!check_writable(var)) {
+                status = 1;
+                continue;
+            }
+            set_value(var, equals + 1);
+        }
+        if (readonly) {
+            var->readonly = true;
+        } else {
+            set_exported(var);
+        }
+    }
+    return status;
+}
+
+int cmd_export(const PtrArray *arguments) {
+    return declare(arguments, "export", false);
+}
+
+int cmd_readonly(const PtrArray *arguments) {
+    return declare(arguments, "readonly", true);
+}
+
+int cmd_unset(const PtrArray *arguments) {
+    size_t num_args = ptr_array_get_size(arguments);
+    size_t first_name = 1;
+    if (num_args > 1 && strcmp(ptr_array_get_const(arguments, 1), "-f") == 0) {
+        // The shell has no functions to unset.
+        return 0;
+    } else if (num_args > 1 && strcmp(ptr_array_get_const(arguments, 1), "-v") == 0) {
+        first_name = 2;
+    }
+
+    int status = 0;
+    for (size_t i = first_name; i < num_args; i++) {
+        const char *name = ptr_array_get_const(arguments, i);
+        if (!is_valid_name(name)) {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", name);
+            status = 1;
+        } else if (!var_unset(name)) {
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int cmd_local(const PtrArray *arguments) {
+    // Local variables belong to function calls, which the shell does not have.
+    fprintf(stderr, "local: can only be used in a function\n");
+    return 1;
+}
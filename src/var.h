@@ -0,0 +1,57 @@
+#ifndef CODECRAFTERS_SHELL_VAR_H_INCLUDED
+#define CODECRAFTERS_SHELL_VAR_H_INCLUDED
+
+#include <stdbool.h>
+
+#include "ptr_array.h"
+
+// Imports the environment of the shell as exported variables.
+void vars_init(void);
+
+// Returns the value of a variable, or NULL if it is not set.
+const char *var_get(const char *name);
+
+// Sets a variable. Returns false after reporting an error if the variable is readonly.
+bool var_set(const char *name, const char *value);
+
+// Makes a variable an array of strings, taking ownership of the elements. Its value as a plain
+// variable is the first element. Returns false after reporting an error if the variable is
+// readonly.
+bool var_set_array(const char *name, PtrArray *elements);
+
+// Returns the elements of an array variable, or NULL if the variable is not an array.
+const PtrArray *var_get_array(const char *name);
+
+// Sets a variable from a NAME=value string, optionally exporting it. Returns false after reporting
+// an error if the variable is readonly.
+bool var_assign(const char *assignment, bool export);
+
+// Unsets a variable. Returns false after reporting an error if the variable is readonly.
+bool var_unset(const char *name);
+
+// Returns the environment for executed commands: a NULL-terminated array of NAME=value strings of
+// the exported variables other than arrays. The array is rebuilt when an exported variable changes,
+// and environ points to it.
+char **var_get_envp(void);
+
+// Returns the bytes that the environment takes in execve(), counting the strings and the pointers
+// to them.
+size_t var_get_envp_size(void);
+
+// Returns a number that changes whenever PATH does, so that caches derived from it can tell when
+// they are stale.
+unsigned long var_get_path_generation(void);
+
+// Exports variables, optionally assigning them (the export builtin).
+int cmd_export(const PtrArray *arguments);
+
+// Makes variables readonly, optionally assigning them (the readonly builtin).
+int cmd_readonly(const PtrArray *arguments);
+
+// Unsets variables (the unset builtin).
+int cmd_unset(const PtrArray *arguments);
+
+// Declares variables local to a function (the local builtin).
+int cmd_local(const PtrArray *arguments);
+
+#endif
@@ -1,10 +1,12 @@
 #include "xmalloc.h"
+#include "stats.h"
 
 #include <err.h>
 #include <stdlib.h>
 #include <string.h>
 
 void *xmalloc(size_t size) {
+    stats_count_allocation();
     void *ptr = malloc(size);
     if (ptr == NULL) {
         err(EXIT_FAILURE, "malloc");
@@ -13,6 +15,7 @@ void *xmalloc(size_t size) {
 }
 
 void *xrealloc(void *ptr, size_t size) {
+    stats_count_allocation();
     ptr = realloc(ptr, size);
     if (ptr == NULL) {
         err(EXIT_FAILURE, "realloc");
@@ -21,6 +24,7 @@ void *xrealloc(void *ptr, size_t size) {
 }
 
 char *xstrdup(const char *s1) {
+    stats_count_allocation();
     char *s2 = strdup(s1);
     if (s2 == NULL) {
         err(EXIT_FAILURE, "strdup");
@@ -29,6 +33,7 @@ char *xstrdup(const char *s1) {
 }
 
 char *xstrndup(const char *s1, size_t n) {
+    stats_count_allocation();
     char *s2 = strndup(s1, n);
     if (s2 == NULL) {
         err(EXIT_FAILURE, "strndup");
@@ -0,0 +1,251 @@
+// Prints the records of an audit log written by the shell, oldest first, one per line.
+
+#include "audit.h"
+
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *ring;
+static uint64_t capacity;
+
+static void print_time(const char *label, uint64_t ns) {
+    time_t sec = ns / 1000000000;
+    struct tm tm;
+    gmtime_r(&sec, &tm);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    printf(" %s=%s.%09" PRIu64 "Z", label, buf, ns % 1000000000);
+}
+
+static void print_duration(uint64_t start_ns, uint64_t end_ns) {
+    printf(" duration=%.6fs", end_ns >= start_ns ? (end_ns - start_ns) / 1e9 : 0.0);
+}
+
+static void print_string(const char *s) {
+    putchar('\'');
+    for (; *s != '\0'; s++) {
+        if (*s == '\'') {
+            printf("'\\''");
+        } else if (*s == '\n') {
+            printf("\\n");
+        } else {
+            putchar(*s);
+        }
+    }
+    putchar('\'');
+}
+
+static void print_quoted(const char *label, const char *s) {
+    printf(" %s=", label);
+    print_string(s);
+}
+
+// Returns the string at *p and moves past it, or NULL if it is not terminated before end.
+static const char *next_string(const char **p, const char *end) {
+    const char *nul = memchr(*p, '\0', end - *p);
+    if (nul == NULL) {
+        return NULL;
+    }
+    const char *s = *p;
+    *p = nul + 1;
+    return s;
+}
+
+static bool print_pipeline(const char *p, const char *end) {
+    AuditPipeline pipeline;
+    if ((size_t)(end - p) < sizeof(pipeline)) {
+        return false;
+    }
+    memcpy(&pipeline, p, sizeof(pipeline));
+    p += sizeof(pipeline);
+    if ((size_t)(end - p) < sizeof(int32_t) * pipeline.num_stages) {
+        return false;
+    }
+
+    printf("pipeline pid=%" PRId32, pipeline.pid);
+    print_time("start", pipeline.start_ns);
+    print_duration(pipeline.start_ns, pipeline.end_ns);
+    if (pipeline.background) {
+        printf(" background");
+    } else {
+        printf(" status=%" PRId32 " pipestatus=", pipeline.status);
+        for (uint32_t i = 0; i < pipeline.num_stages; i++) {
+            int32_t status;
+            memcpy(&status, p + sizeof(status) * i, sizeof(status));
+            printf("%s%" PRId32, i > 0 ? "," : "", status);
+        }
+    }
+    p += sizeof(int32_t) * pipeline.num_stages;
+
+    const char *cwd = next_string(&p, end);
+    const char *text = cwd != NULL ? next_string(&p, end) : NULL;
+    if (text == NULL) {
+        return false;
+    }
+    print_quoted("cwd", cwd);
+    print_quoted("text", text);
+    return true;
+}
+
+static bool print_exec(const char *p, const char *end) {
+    AuditExec exec;
+    if ((size_t)(end - p) < sizeof(exec)) {
+        return false;
+    }
+    memcpy(&exec, p, sizeof(exec));
+    p += sizeof(exec);
+
+    printf("exec pid=%" PRId32, exec.pid);
+    print_time("time", exec.time_ns);
+    printf(" argv=");
+    for (uint32_t i = 0; i < exec.argc; i++) {
+        const char *arg = next_string(&p, end);
+        if (arg == NULL) {
+            return false;
+        }
+        if (i > 0) {
+            putchar(' ');
+        }
+        print_string(arg);
+    }
+    return true;
+}
+
+static bool print_process(const char *p, const char *end) {
+    AuditProcess process;
+    if ((size_t)(end - p) < sizeof(process)) {
+        return false;
+    }
+    memcpy(&process, p, sizeof(process));
+
+    printf("process pid=%" PRId32, process.pid);
+    print_time("start", process.start_ns);
+    print_duration(process.start_ns, process.end_ns);
+    if (WIFSIGNALED(process.wait_status)) {
+        printf(" signal=%d", WTERMSIG(process.wait_status));
+    } else {
+        printf(" status=%d", WEXITSTATUS(process.wait_status));
+    }
+    printf(" utime=%.6fs stime=%.6fs maxrss=%" PRId64 "KB minflt=%" PRId64 " majflt=%" PRId64
+           " inblock=%" PRId64 " oublock=%" PRId64 " nvcsw=%" PRId64 " nivcsw=%" PRId64,
+           process.utime_us / 1e6, process.stime_us / 1e6, process.maxrss_kb, process.minflt,
+           process.majflt, process.inblock, process.oublock, process.nvcsw, process.nivcsw);
+    return true;
+}
+
+static const AuditRecord *record_at(uint64_t offset) {
+    return (const AuditRecord *)(ring + (offset & (capacity - 1)));
+}
+
+static bool is_plausible_size(uint64_t size) {
+    return size >= sizeof(AuditRecord) && size <= capacity &&
+           size % sizeof(AuditRecord) == 0;
+}
+
+// Copies a record out of the ring, in case it wraps around the end or a writer overwrites it
+// meanwhile. Returns false if the record is not complete at offset.
+static bool copy_record(uint64_t offset, char *buf, uint32_t *size, uint32_t *type) {
+    const AuditRecord *record = record_at(offset);
+    if (atomic_load_explicit(&record->offset, memory_order_acquire) != offset) {
+        return false;
+    }
+    *size = record->size;
+    *type = record->type;
+    if (!is_plausible_size(*size)) {
+        return false;
+    }
+
+    uint64_t pos = offset & (capacity - 1);
+    size_t first = *size < capacity - pos ? *size : capacity - pos;
+    memcpy(buf, ring + pos, first);
+    memcpy(buf + first, ring, *size - first);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&record->offset, memory_order_relaxed) == offset;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s FILE\n", argv[0]);
+        return 2;
+    }
+    int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        err(EXIT_FAILURE, "%s", argv[1]);
+    }
+    if (st.st_size < AUDIT_HEADER_SIZE) {
+        errx(EXIT_FAILURE, "%s: not an audit log", argv[1]);
+    }
+    const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        err(EXIT_FAILURE, "%s", argv[1]);
+    }
+    close(fd);
+
+    const AuditHeader *header = (const AuditHeader *)map;
+    capacity = header->capacity;
+    if (memcmp(header->magic, AUDIT_MAGIC, sizeof(AUDIT_MAGIC)) != 0 ||
+        header->version != AUDIT_VERSION || header->header_size != AUDIT_HEADER_SIZE ||
+        capacity < AUDIT_HEADER_SIZE || (capacity & (capacity - 1)) != 0 ||
+        (uint64_t)st.st_size < AUDIT_HEADER_SIZE + capacity) {
+        errx(EXIT_FAILURE, "%s: not an audit log", argv[1]);
+    }
+    ring = map + AUDIT_HEADER_SIZE;
+
+    // Once the ring has wrapped around, the oldest record starts somewhere after the oldest byte.
+    // A record whose stored offset is its own position is taken as the first one.
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_acquire);
+    uint64_t offset = head > capacity ? head - capacity : 0;
+    char *buf = malloc(capacity);
+    if (buf == NULL) {
+        err(EXIT_FAILURE, "malloc");
+    }
+    bool synced = offset == 0;
+    while (offset < head) {
+        uint32_t size, type;
+        if (!copy_record(offset, buf, &size, &type)) {
+            // A record that is still being written, or whose writer died, is skipped whole if its
+            // size can be trusted.
+            uint32_t skipped = record_at(offset)->size;
+            offset += synced && is_plausible_size(skipped) ? skipped : sizeof(AuditRecord);
+            continue;
+        }
+        synced = true;
+
+        const char *p = buf + sizeof(AuditRecord);
+        const char *end = buf + size;
+        bool ok;
+        switch (type) {
+            case AUDIT_PIPELINE:
+                ok = print_pipeline(p, end);
+                break;
+            case AUDIT_EXEC:
+                ok = print_exec(p, end);
+                break;
+            case AUDIT_PROCESS:
+                ok = print_process(p, end);
+                break;
+            default:
+                printf("unknown type=%" PRIu32, type);
+                ok = true;
+                break;
+        }
+        if (!ok) {
+            printf(" (truncated)");
+        }
+        printf("\n");
+        offset += size;
+    }
+    free(buf);
+    return 0;
+}